@@ -0,0 +1,389 @@
+/*
+ * bench.c - microbenchmarks for the Nuggets server's hot paths
+ *
+ * Times, on each map given, the operations a game spends its time in:
+ *   gridInit              loading the map and placing the gold
+ *   updateVisibility      recomputing a player's view from a new spot
+ *                         (lineCheck for every point of the map)
+ *   gridDisplay           a player's display: render, clip, and queue
+ *   gridDisplaySpectator  the spectator's display: render and queue
+ *   movePlayer            one step (lower case) and a run (upper case),
+ *                         visibility included, cycling through directions
+ *   format GOLD           building a GOLD message in scratch memory
+ *   game_summary          building and queueing the game-over summary
+ *
+ * Every operation runs 'warmup' times untimed, then 'repeat' times, each
+ * timed on its own into a histogram (see lib/histogram.h). Results go to
+ * stdout as CSV or JSON, one record per map and operation, with times in
+ * microseconds. Messages are queued in the outbox and flushed as the
+ * server would, but nothing is sent: the message module is never
+ * initialized, so message_send returns at once.
+ *
+ * usage: ./bench [--repeat n] [--warmup n] [--format csv|json] map.txt...
+ *
+ * Maps that cannot be loaded, or have too few room spots for the
+ * players, are skipped with a note on stderr.
+ *
+ * Binary Brigade, Spring 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include "../support/message.h"
+#include "../grid/grid.h"
+#include "../player/player.h"
+#include "../game/game.h"
+#include "../outbox/outbox.h"
+#include "../lib/mem.h"
+#include "../lib/scratch.h"
+#include "../lib/timing.h"
+#include "../lib/histogram.h"
+
+/**************** local constants ****************/
+enum { nPlayers = 4 };      // an enum, since it sizes the context's arrays
+static const int randomSeed = 1;
+static const char* steps = "hjklyubn";
+static const char* runs = "HJKLYUBN";
+
+/**************** local types ****************/
+typedef enum { csv, json } format_t;
+
+// one operation under test, run on the map loaded in the current context
+typedef struct context {
+  char* mapPath;
+  player_t* players[nPlayers + 1];   // nPlayers on the map, then the viewer
+  addr_t addresses[nPlayers + 1];
+  addr_t spectator;
+  gridpoint_t** spots;    // every open point, to move a viewer between
+  int nSpots;
+  int next;               // iteration number, for operations that cycle
+} context_t;
+
+typedef void (*operation_t)(context_t* context);
+
+/**************** global variables ****************/
+static struct {
+  int repeat;
+  int warmup;
+  format_t format;
+} options = { 1000, 100, csv };
+
+static int nRecords = 0;           // records printed so far, for JSON commas
+static histogram_t times;          // 4 KiB, reused for every operation
+
+/**************** local functions ****************/
+static bool parseArgs(int argc, char* argv[]);
+static void benchMap(char* mapPath);
+static bool setUp(context_t* context, mem_arena_t* arena);
+static void measure(context_t* context, const char* name, operation_t operation);
+static void printRecord(const char* mapPath, const char* name);
+static void loadMap(context_t* context);
+static void seeFromSpot(context_t* context);
+static void displayPlayer(context_t* context);
+static void displaySpectator(context_t* context);
+static void stepPlayer(context_t* context);
+static void runPlayer(context_t* context);
+static void formatGold(context_t* context);
+static void summarize(context_t* context);
+
+/**************** main ****************/
+int
+main(int argc, char* argv[])
+{
+  if (!parseArgs(argc, argv)) {
+    fprintf(stderr, "usage: %s [--repeat n] [--warmup n] [--format csv|json] map.txt...\n", argv[0]);
+    return 1;
+  }
+
+  if (options.format == csv) {
+    printf("map,operation,repeat,mean_us,p50_us,p90_us,p99_us,max_us\n");
+  } else {
+    printf("[\n");
+  }
+  for (int i = optind; i < argc; i++) {
+    benchMap(argv[i]);
+  }
+  if (options.format == json) {
+    printf("\n]\n");
+  }
+  scratch_done();
+  return 0;
+}
+
+/**************** parseArgs ****************/
+/* Parses the command line into 'options'; the maps are left in argv
+ * from optind on.
+ * We return:
+ *   true if the arguments are valid, with at least one map.
+ */
+static bool
+parseArgs(int argc, char* argv[])
+{
+  static const struct option longOptions[] = {
+    { "repeat", required_argument, NULL, 'r' },
+    { "warmup", required_argument, NULL, 'w' },
+    { "format", required_argument, NULL, 'f' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+    switch (opt) {
+      case 'r':
+        options.repeat = atoi(optarg);
+        if (options.repeat < 1) {
+          fprintf(stderr, "--repeat must be positive\n");
+          return false;
+        }
+        break;
+      case 'w':
+        options.warmup = atoi(optarg);
+        if (options.warmup < 0) {
+          fprintf(stderr, "--warmup must not be negative\n");
+          return false;
+        }
+        break;
+      case 'f':
+        if (strcmp(optarg, "csv") == 0) {
+          options.format = csv;
+        } else if (strcmp(optarg, "json") == 0) {
+          options.format = json;
+        } else {
+          fprintf(stderr, "--format must be csv or json\n");
+          return false;
+        }
+        break;
+      default:
+        return false;
+    }
+  }
+  return optind < argc;
+}
+
+/**************** benchMap ****************/
+/* Times every operation on one map, printing a record for each.
+ */
+static void
+benchMap(char* mapPath)
+{
+  context_t context = { .mapPath = mapPath };
+
+  // a map that cannot be loaded is skipped
+  mem_arena_t* arena = mem_assert(mem_arena_new(0), "bench arena");
+  grid_t* grid = gridInit(mapPath, randomSeed, arena);
+  gridDelete();
+  mem_arena_delete(arena);
+  if (grid == NULL) {
+    fprintf(stderr, "%s: cannot load the map; skipped\n", mapPath);
+    return;
+  }
+
+  // loading is timed on its own, each time into a fresh arena
+  measure(&context, "gridInit", loadMap);
+
+  // the rest run on one game, with players and a spectator
+  arena = mem_assert(mem_arena_new(0), "bench arena");
+  srand(randomSeed);
+  grid = gridInit(mapPath, randomSeed, arena);
+  initialize_game(grid, arena);
+  outbox_init(0);
+  if (setUp(&context, arena)) {
+    measure(&context, "updateVisibility", seeFromSpot);
+    measure(&context, "gridDisplay", displayPlayer);
+    measure(&context, "gridDisplaySpectator", displaySpectator);
+    measure(&context, "movePlayer step", stepPlayer);
+    measure(&context, "movePlayer run", runPlayer);
+    measure(&context, "format GOLD", formatGold);
+    measure(&context, "game_summary", summarize);
+  } else {
+    fprintf(stderr, "%s: fewer than %d room spots; skipped\n", mapPath, nPlayers);
+  }
+
+  outbox_done();
+  if (context.players[nPlayers] != NULL) {
+    player_delete(context.players[nPlayers]);   // the viewer is not in the game
+  }
+  delete_game();
+  gridDelete();
+  mem_free(context.spots);
+  mem_arena_delete(arena);
+}
+
+/**************** setUp ****************/
+/* Finds the map's open points, and adds the players, one more player
+ * who is never placed on the map (the viewer, moved about by
+ * updateVisibility), and the spectator.
+ * We return:
+ *   false if the map has too few room spots for the players.
+ */
+static bool
+setUp(context_t* context, mem_arena_t* arena)
+{
+  const int nRows = getnRows();
+  const int nColumns = getnColumns();
+  context->spots = mem_malloc_assert(nRows * nColumns * sizeof(gridpoint_t*), "spots");
+  context->nSpots = 0;
+  int roomSpots = 0;
+  for (int row = 0; row < nRows; row++) {
+    for (int column = 0; column < nColumns; column++) {
+      gridpoint_t* point = getPoint(row, column);
+      if (getTerrain(point) == '.' || getTerrain(point) == '#') {
+        context->spots[context->nSpots++] = point;
+        roomSpots += (getTerrain(point) == '.');
+      }
+    }
+  }
+  if (roomSpots < nPlayers + 1) {
+    return false;
+  }
+
+  for (int i = 0; i <= nPlayers; i++) {
+    char port[8];
+    char name[16];
+    sprintf(port, "%d", 1024 + i);
+    sprintf(name, "bench%d", i);
+    message_setAddr("127.0.0.1", port, &context->addresses[i]);
+    context->players[i] = mem_assert(player_new(context->addresses[i], name, 0, 0, ' ', arena), "player");
+    if (i < nPlayers) {
+      add_player(context->players[i]);
+      placePlayer(context->players[i]);
+    }
+  }
+  message_setAddr("127.0.0.1", "2048", &context->spectator);
+  add_spectator(context->spectator, 0);
+  return true;
+}
+
+/**************** measure ****************/
+/* Runs the operation 'warmup' times, then 'repeat' times, timing each,
+ * and prints the record. Queued messages are flushed, and scratch
+ * memory is reset, after each run, outside the timing, as the server
+ * does after each event.
+ */
+static void
+measure(context_t* context, const char* name, operation_t operation)
+{
+  context->next = 0;
+  for (int i = 0; i < options.warmup; i++) {
+    (*operation)(context);
+    outbox_drain();
+    scratch_reset();
+  }
+  histogram_reset(&times);
+  for (int i = 0; i < options.repeat; i++) {
+    int64_t start = timing_now();
+    (*operation)(context);
+    histogram_record(&times, timing_now() - start);
+    outbox_drain();
+    scratch_reset();
+  }
+  printRecord(context->mapPath, name);
+}
+
+/**************** printRecord ****************/
+/* Prints the times just measured, in the chosen format.
+ */
+static void
+printRecord(const char* mapPath, const char* name)
+{
+  const double mean = histogram_mean(&times) / 1e3;
+  const double p50 = histogram_percentile(&times, 50) / 1e3;
+  const double p90 = histogram_percentile(&times, 90) / 1e3;
+  const double p99 = histogram_percentile(&times, 99) / 1e3;
+  const double max = times.max / 1e3;
+  if (options.format == csv) {
+    printf("%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n", mapPath, name, options.repeat,
+           mean, p50, p90, p99, max);
+  } else {
+    printf("%s  {\"map\": \"%s\", \"operation\": \"%s\", \"repeat\": %d, "
+           "\"mean_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, "
+           "\"p99_us\": %.3f, \"max_us\": %.3f}", nRecords > 0 ? ",\n" : "",
+           mapPath, name, options.repeat, mean, p50, p90, p99, max);
+  }
+  nRecords++;
+  fflush(stdout);
+}
+
+/**************** loadMap ****************/
+/* Loads the map into a fresh arena, and throws it away.
+ */
+static void
+loadMap(context_t* context)
+{
+  mem_arena_t* arena = mem_assert(mem_arena_new(0), "bench arena");
+  gridInit(context->mapPath, randomSeed, arena);
+  gridDelete();
+  mem_arena_delete(arena);
+}
+
+/**************** seeFromSpot ****************/
+/* Moves the viewer to the next open point, and updates what it sees.
+ */
+static void
+seeFromSpot(context_t* context)
+{
+  player_t* viewer = context->players[nPlayers];
+  gridpoint_t* spot = context->spots[context->next++ % context->nSpots];
+  set_y(viewer, getPointRow(spot));
+  set_x(viewer, getPointColumn(spot));
+  updateVisibility(viewer);
+}
+
+/**************** displayPlayer ****************/
+/* Builds and queues the first player's display.
+ */
+static void
+displayPlayer(context_t* context)
+{
+  gridDisplay(context->addresses[0], context->players[0]);
+}
+
+/**************** displaySpectator ****************/
+/* Builds and queues the spectator's display.
+ */
+static void
+displaySpectator(context_t* context)
+{
+  gridDisplaySpectator(context->spectator);
+}
+
+/**************** stepPlayer ****************/
+/* Moves the first player one step, in the next direction.
+ */
+static void
+stepPlayer(context_t* context)
+{
+  movePlayer(context->players[0], steps[context->next++ % strlen(steps)]);
+}
+
+/**************** runPlayer ****************/
+/* Runs the first player as far as possible, in the next direction.
+ */
+static void
+runPlayer(context_t* context)
+{
+  movePlayer(context->players[0], runs[context->next++ % strlen(runs)]);
+}
+
+/**************** formatGold ****************/
+/* Builds a GOLD message, as the server does after a pickup.
+ */
+static void
+formatGold(context_t* context)
+{
+  player_t* player = context->players[context->next++ % nPlayers];
+  scratch_printf("GOLD %d %d %d", context->next % 50, get_gold(player), get_available_gold());
+}
+
+/**************** summarize ****************/
+/* Builds the game summary, and queues it for the first player.
+ */
+static void
+summarize(context_t* context)
+{
+  game_summary(context->addresses[0]);
+}
@@ -0,0 +1,688 @@
+/*
+ * Nuggets bots.c file
+ *
+ * A headless load generator: joins a server as any number of players,
+ * each on its own socket, drives them with a movement pattern at a
+ * fixed rate of keystrokes, and reports the throughput it saw and the
+ * latency from each keystroke to the display that shows its effect.
+ *
+ * Binary Brigade, Spring, 2023
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "../support/message.h"
+#include "../lib/timing.h"
+
+// how each bot chooses its next key
+typedef enum pattern {
+    randomWalk,         // a random step into a point known to be open
+    goldSeeking,        // a step towards the nearest visible gold
+    sprinting           // a random upper-case run
+} pattern_t;
+
+// bots waiting on the server for this long give up on their oldest move
+static const double moveTimeout = 1.0;
+enum { maxPending = 32 };   // an enum, since it sizes the rings of moves
+
+// one player driven by this program
+typedef struct bot {
+    int socket;
+    char letter;            // from OK; 0 until the server lets us in
+    bool done;              // the server sent QUIT, or we never got in
+    char* display;          // the last DISPLAY, as received
+    size_t displaySize;
+    int row;                // our '@' in that display, in map coordinates;
+    int col;                //   -1 if not seen yet
+    int64_t nextKey;        // when the next keystroke is due
+    int64_t pending[maxPending];  // when each move not yet seen on screen was sent,
+    char pendingKeys[maxPending]; //   and its key, oldest first, in a ring
+    int firstPending;
+    int nPending;
+} bot_t;
+
+// what the bots saw, over all of them
+typedef struct stats {
+    int joined;
+    int refused;
+    bool gameOver;
+    long keys;
+    long messages;
+    long displays;
+    long golds;
+    long bytes;
+    long unanswered;        // moves never seen on screen
+    long ineffective;       // moves the server answered without moving us
+    long unmatched;         // moves dropped because a display they can't explain moved us
+    int64_t* latencies;     // key-to-display times, in ns
+    long nLatencies;
+    long maxLatencies;
+} stats_t;
+
+// settings from the command line
+static struct {
+    int players;            // bots to start
+    double rate;            // keystrokes per second per bot
+    double duration;        // seconds to run
+    pattern_t pattern;
+    char* hostname;
+    char* port;
+} options;
+
+static stats_t stats;
+
+static const char moveKeys[] = "hljkyubn";
+
+bool parseArgs(const int argc, char* argv[]);
+bool startBot(bot_t* bot, const addr_t server, const int number);
+void receive(bot_t* bot);
+void handleMessage(bot_t* bot, const char* message, const int length);
+void handleDisplay(bot_t* bot, const char* message);
+int matchMoves(const bot_t* bot, const int row, const int col, bool moved[]);
+char pointAt(const char* display, const int row, const int col);
+void sendKey(bot_t* bot, const addr_t server, const char key);
+char chooseKey(const bot_t* bot);
+bool findFrame(const char* display, const char** body, int* width, int* height, int* top, int* left);
+bool isOpen(const char point);
+void keyStep(const char key, int* changeRow, int* changeCol);
+void noteLatency(const int64_t latency);
+void report(const double elapsed);
+int compareTimes(const void* a, const void* b);
+
+/**************** main ****************/
+/*
+ * starts the bots, runs them for the requested time, and reports
+ */
+int
+main(int argc, char* argv[])
+{
+    if (!parseArgs(argc, argv)) {
+        fprintf(stderr, "Usage: ./bots [--players n] [--rate keysPerSecond] [--duration seconds]\n"
+                        "              [--pattern random|gold|sprint] hostname port\n");
+        return 1;
+    }
+
+    addr_t server;
+    if (!message_setAddr(options.hostname, options.port, &server)) {
+        fprintf(stderr, "can't form address from %s %s\n", options.hostname, options.port);
+        return 2;
+    }
+
+    bot_t* bots = calloc(options.players, sizeof(bot_t));
+    struct pollfd* fds = calloc(options.players, sizeof(struct pollfd));
+    if (bots == NULL || fds == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 3;
+    }
+    srand(getpid());
+
+    for (int i = 0; i < options.players; i++) {
+        if (!startBot(&bots[i], server, i + 1)) {
+            fprintf(stderr, "can't open a socket for bot %d\n", i + 1);
+            return 3;
+        }
+        fds[i].fd = bots[i].socket;
+        fds[i].events = POLLIN;
+    }
+
+    const int64_t interval = 1e9 / options.rate;
+    const int64_t start = timing_now();
+    const int64_t end = start + options.duration * 1e9;
+    int64_t now = start;
+
+    while (now < end && !stats.gameOver) {
+        // sleeping until a keystroke is due, or something arrives
+        int64_t wake = end;
+        bool anyLeft = false;
+        for (int i = 0; i < options.players; i++) {
+            if (!bots[i].done) {
+                anyLeft = true;
+                if (bots[i].letter != 0 && bots[i].nextKey < wake) {
+                    wake = bots[i].nextKey;
+                }
+            }
+        }
+        if (!anyLeft) {
+            break;
+        }
+        int timeout = (wake > now) ? (wake - now + 999999) / 1000000 : 0;
+        if (poll(fds, options.players, timeout) < 0) {
+            perror("poll");
+            break;
+        }
+
+        for (int i = 0; i < options.players; i++) {
+            if (fds[i].revents & POLLIN) {
+                receive(&bots[i]);
+            }
+        }
+
+        now = timing_now();
+        for (int i = 0; i < options.players; i++) {
+            bot_t* bot = &bots[i];
+            if (bot->done || bot->letter == 0) {
+                continue;
+            }
+            // moves the server never showed us are abandoned
+            while (bot->nPending > 0
+                   && timing_seconds(now - bot->pending[bot->firstPending]) > moveTimeout) {
+                bot->firstPending = (bot->firstPending + 1) % maxPending;
+                bot->nPending--;
+                stats.unanswered++;
+            }
+            if (bot->nextKey <= now) {
+                sendKey(bot, server, chooseKey(bot));
+                // a bot that fell behind does not try to catch up in a burst
+                bot->nextKey += interval;
+                if (bot->nextKey < now) {
+                    bot->nextKey = now + interval;
+                }
+            }
+        }
+    }
+    double elapsed = timing_seconds(timing_now() - start);
+
+    // leaving the game, and tidying up
+    for (int i = 0; i < options.players; i++) {
+        if (!bots[i].done && bots[i].letter != 0) {
+            sendKey(&bots[i], server, 'Q');
+            stats.keys--;
+        }
+        stats.unanswered += bots[i].nPending;
+        close(bots[i].socket);
+        free(bots[i].display);
+    }
+    free(bots);
+    free(fds);
+
+    report(elapsed);
+    free(stats.latencies);
+    return 0;
+}
+
+/**************** parseArgs ****************/
+/*
+ * Parses the command line into 'options':
+ *   [--players n] [--rate keysPerSecond] [--duration seconds]
+ *   [--pattern random|gold|sprint] hostname port
+ *
+ * We return:
+ *   true if valid arguments, false otherwise
+ */
+bool
+parseArgs(const int argc, char* argv[])
+{
+    static const struct option longOptions[] = {
+        { "players", required_argument, NULL, 'n' },
+        { "rate", required_argument, NULL, 'r' },
+        { "duration", required_argument, NULL, 'd' },
+        { "pattern", required_argument, NULL, 'p' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    options.players = 1;
+    options.rate = 10;
+    options.duration = 10;
+    options.pattern = randomWalk;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:r:d:p:", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                options.players = atoi(optarg);
+                if (options.players < 1) {
+                    fprintf(stderr, "--players must be at least 1\n");
+                    return false;
+                }
+                break;
+            case 'r':
+                options.rate = atof(optarg);
+                if (options.rate <= 0 || options.rate > 10000) {
+                    fprintf(stderr, "--rate must be between 0 and 10000 keys per second\n");
+                    return false;
+                }
+                break;
+            case 'd':
+                options.duration = atof(optarg);
+                if (options.duration <= 0) {
+                    fprintf(stderr, "--duration must be a positive number of seconds\n");
+                    return false;
+                }
+                break;
+            case 'p':
+                if (strcmp(optarg, "random") == 0) {
+                    options.pattern = randomWalk;
+                } else if (strcmp(optarg, "gold") == 0) {
+                    options.pattern = goldSeeking;
+                } else if (strcmp(optarg, "sprint") == 0) {
+                    options.pattern = sprinting;
+                } else {
+                    fprintf(stderr, "--pattern must be random, gold, or sprint\n");
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+
+    // hostname and port
+    if (argc - optind != 2 || atoi(argv[optind + 1]) == 0) {
+        return false;
+    }
+    options.hostname = argv[optind];
+    options.port = argv[optind + 1];
+    return true;
+}
+
+/**************** startBot ****************/
+/*
+ * Opens the bot's own socket and asks to join as "bot<number>".
+ * Its first keystroke is due at a random point in the first interval,
+ * so the bots do not all press keys at once.
+ *
+ * We return:
+ *   true if the socket could be opened, false otherwise
+ */
+bool
+startBot(bot_t* bot, const addr_t server, const int number)
+{
+    bot->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (bot->socket < 0) {
+        return false;
+    }
+    bot->row = -1;
+    bot->col = -1;
+    bot->nextKey = timing_now() + (int64_t)(rand() / (RAND_MAX + 1.0) * 1e9 / options.rate);
+
+    char play[32];
+    sprintf(play, "PLAY bot%d", number);
+    sendto(bot->socket, play, strlen(play), 0, (const struct sockaddr*)&server, sizeof(server));
+    return true;
+}
+
+/**************** receive ****************/
+/*
+ * Reads every message waiting on the bot's socket.
+ */
+void
+receive(bot_t* bot)
+{
+    static char buffer[65507];
+    int length;
+    while ((length = recv(bot->socket, buffer, sizeof(buffer) - 1, MSG_DONTWAIT)) > 0) {
+        buffer[length] = '\0';
+        handleMessage(bot, buffer, length);
+    }
+}
+
+/**************** handleMessage ****************/
+/*
+ * Counts one message from the server and acts on it
+ */
+void
+handleMessage(bot_t* bot, const char* message, const int length)
+{
+    stats.messages++;
+    stats.bytes += length;
+
+    if (strncmp(message, "OK ", strlen("OK ")) == 0) {
+        bot->letter = message[strlen("OK ")];
+        stats.joined++;
+    } else if (strncmp(message, "DISPLAY", strlen("DISPLAY")) == 0) {
+        stats.displays++;
+        handleDisplay(bot, message);
+    } else if (strncmp(message, "GOLD ", strlen("GOLD ")) == 0) {
+        stats.golds++;
+    } else if (strncmp(message, "QUIT", strlen("QUIT")) == 0) {
+        if (bot->letter == 0) {
+            stats.refused++;
+        } else if (strstr(message, "GAME OVER") != NULL) {
+            stats.gameOver = true;
+        }
+        bot->done = true;
+    }
+}
+
+/**************** handleDisplay ****************/
+/*
+ * Keeps the display for choosing keys. If our '@' has moved, works out
+ * which pending moves took it there (see matchMoves), and notes the
+ * latency of each that moved us. A display that moved us in a way no
+ * run of our pending moves explains (another player swapped places
+ * with us) gives no samples, and since any of the pending moves may
+ * be in it, they are all dropped rather than matched to later ones.
+ */
+void
+handleDisplay(bot_t* bot, const char* message)
+{
+    // where this display puts our '@', in map coordinates
+    const char* body;
+    int width, height, top, left;
+    if (!findFrame(message, &body, &width, &height, &top, &left)) {
+        return;
+    }
+    const char* at = strchr(body, '@');
+    if (at == NULL) {
+        return;
+    }
+    int row = (at - body) / (width + 1) + top;
+    int col = (at - body) % (width + 1) + left;
+
+    // the moves are replayed on the display before this one
+    if ((row != bot->row || col != bot->col) && bot->row >= 0 && bot->nPending > 0) {
+        bool moved[maxPending];
+        int answered = matchMoves(bot, row, col, moved);
+        if (answered == 0) {
+            stats.unmatched += bot->nPending;
+            bot->nPending = 0;
+        }
+        int64_t now = timing_now();
+        for (int i = 0; i < answered; i++) {
+            if (moved[i]) {
+                noteLatency(now - bot->pending[bot->firstPending]);
+            } else {
+                stats.ineffective++;
+            }
+            bot->firstPending = (bot->firstPending + 1) % maxPending;
+            bot->nPending--;
+        }
+    }
+    bot->row = row;
+    bot->col = col;
+
+    size_t length = strlen(message) + 1;
+    if (bot->displaySize < length) {
+        char* grown = realloc(bot->display, length);
+        if (grown == NULL) {
+            return;
+        }
+        bot->display = grown;
+        bot->displaySize = length;
+    }
+    memcpy(bot->display, message, length);
+}
+
+/**************** matchMoves ****************/
+/*
+ * Replays the bot's pending moves, oldest first, from where the last
+ * display put its '@', to find those that took it to (row, col). The
+ * server applies our keys in order, so those are always the oldest
+ * few. A step into a point the last display shows closed (a wall hit)
+ * moves nothing; a run (upper-case key) goes on while the way is open,
+ * and may have stopped anywhere along it. Points outside the last
+ * display's window count as open, but end a run.
+ *
+ * We return:
+ *   how many pending moves, oldest first, account for the new
+ *   position, or 0 if none do; moved[i] tells whether the i'th of
+ *   them actually moved us
+ */
+int
+matchMoves(const bot_t* bot, const int row, const int col, bool moved[])
+{
+    int r = bot->row;
+    int c = bot->col;
+    for (int i = 0; i < bot->nPending; i++) {
+        char key = bot->pendingKeys[(bot->firstPending + i) % maxPending];
+        int changeRow, changeCol;
+        keyStep(tolower(key), &changeRow, &changeCol);
+        moved[i] = false;
+        while (true) {
+            char point = pointAt(bot->display, r + changeRow, c + changeCol);
+            if (point != 0 && !isOpen(point)) {
+                break;
+            }
+            r += changeRow;
+            c += changeCol;
+            moved[i] = true;
+            if (r == row && c == col) {
+                return i + 1;
+            }
+            if (!isupper(key) || point == 0) {
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/**************** pointAt ****************/
+/*
+ * Returns the point of the display at the given map coordinates, or
+ * 0 if there is no display or the point lies outside its window
+ */
+char
+pointAt(const char* display, const int row, const int col)
+{
+    const char* body;
+    int width, height, top, left;
+    if (display == NULL || !findFrame(display, &body, &width, &height, &top, &left)) {
+        return 0;
+    }
+    if (row < top || row >= top + height || col < left || col >= left + width) {
+        return 0;
+    }
+    return body[(row - top) * (width + 1) + (col - left)];
+}
+
+/**************** sendKey ****************/
+/*
+ * Sends one keystroke; a move is remembered until it shows on screen
+ */
+void
+sendKey(bot_t* bot, const addr_t server, const char key)
+{
+    char message[8];
+    sprintf(message, "KEY %c", key);
+    sendto(bot->socket, message, strlen(message), 0, (const struct sockaddr*)&server, sizeof(server));
+    stats.keys++;
+
+    if (strchr(moveKeys, tolower(key)) != NULL && bot->nPending < maxPending) {
+        const int last = (bot->firstPending + bot->nPending) % maxPending;
+        bot->pending[last] = timing_now();
+        bot->pendingKeys[last] = key;
+        bot->nPending++;
+    }
+}
+
+/**************** chooseKey ****************/
+/*
+ * Picks the bot's next key according to the pattern, from what the
+ * last display shows around its '@'. Only steps into points known to
+ * be open are considered, so that almost every key moves the bot;
+ * a bot that sees no way out, or no display yet, picks any direction.
+ * A gold seeker steps towards the nearest visible gold (and now and
+ * then at random, so it does not stay stuck behind a wall).
+ */
+char
+chooseKey(const bot_t* bot)
+{
+    const char* body;
+    int width, height, top, left;
+    const char* at = NULL;
+    if (bot->display != NULL && findFrame(bot->display, &body, &width, &height, &top, &left)) {
+        at = strchr(body, '@');
+    }
+    char key = moveKeys[rand() % 8];
+    if (at == NULL) {
+        return options.pattern == sprinting ? toupper(key) : key;
+    }
+    int row = (at - body) / (width + 1);
+    int col = (at - body) % (width + 1);
+
+    // the nearest gold, in steps (diagonals count as one)
+    int goldRow = -1, goldCol = -1, best = width + height;
+    if (options.pattern == goldSeeking && rand() % 4 != 0) {
+        for (const char* gold = strchr(body, '*'); gold != NULL; gold = strchr(gold + 1, '*')) {
+            int r = (gold - body) / (width + 1);
+            int c = (gold - body) % (width + 1);
+            int distance = abs(r - row) > abs(c - col) ? abs(r - row) : abs(c - col);
+            if (distance < best) {
+                best = distance;
+                goldRow = r;
+                goldCol = c;
+            }
+        }
+    }
+
+    // the open direction closest to the gold, else any open direction
+    char towards = 0;
+    int open = 0;
+    for (int i = 0; i < 8; i++) {
+        int changeRow, changeCol;
+        keyStep(moveKeys[i], &changeRow, &changeCol);
+        int r = row + changeRow;
+        int c = col + changeCol;
+        if (r < 0 || r >= height || c < 0 || c >= width || !isOpen(body[r * (width + 1) + c])) {
+            continue;
+        }
+        if (rand() % ++open == 0) {
+            key = moveKeys[i];
+        }
+        if (goldRow >= 0) {
+            int distance = abs(goldRow - r) > abs(goldCol - c) ? abs(goldRow - r) : abs(goldCol - c);
+            if (distance < best) {
+                best = distance;
+                towards = moveKeys[i];
+            }
+        }
+    }
+    if (towards != 0) {
+        key = towards;
+    }
+    return options.pattern == sprinting ? toupper(key) : key;
+}
+
+/**************** findFrame ****************/
+/*
+ * Finds the rows of the map in a DISPLAY message, and the map
+ * coordinates of its window ("DISPLAY top left"; 0 0 for a full one).
+ *
+ * We return:
+ *   true if the display has rows, false otherwise
+ */
+bool
+findFrame(const char* display, const char** body, int* width, int* height, int* top, int* left)
+{
+    *top = 0;
+    *left = 0;
+    sscanf(display, "DISPLAY %d %d", top, left);
+
+    const char* start = strchr(display, '\n');
+    if (start == NULL || start[1] == '\0') {
+        return false;
+    }
+    *body = start + 1;
+    const char* end = strchr(*body, '\n');
+    if (end == NULL || end == *body) {
+        return false;
+    }
+    *width = end - *body;
+    *height = strlen(*body) / (*width + 1);
+    return true;
+}
+
+/**************** isOpen ****************/
+/*
+ * true if a player may step onto this point of the display: a room
+ * spot, a passage, gold, or another player (who trades places)
+ */
+bool
+isOpen(const char point)
+{
+    return point == '.' || point == '#' || point == '*' || isupper(point);
+}
+
+/**************** keyStep ****************/
+/*
+ * Translates a lower-case movement key into one step
+ */
+void
+keyStep(const char key, int* changeRow, int* changeCol)
+{
+    switch (key) {
+        case 'h': *changeRow =  0; *changeCol = -1; break;
+        case 'l': *changeRow =  0; *changeCol =  1; break;
+        case 'j': *changeRow =  1; *changeCol =  0; break;
+        case 'k': *changeRow = -1; *changeCol =  0; break;
+        case 'y': *changeRow = -1; *changeCol = -1; break;
+        case 'u': *changeRow = -1; *changeCol =  1; break;
+        case 'b': *changeRow =  1; *changeCol = -1; break;
+        default:  *changeRow =  1; *changeCol =  1; break;
+    }
+}
+
+/**************** noteLatency ****************/
+/*
+ * Records one key-to-display time
+ */
+void
+noteLatency(const int64_t latency)
+{
+    if (stats.nLatencies == stats.maxLatencies) {
+        long maxLatencies = stats.maxLatencies > 0 ? stats.maxLatencies * 2 : 1024;
+        int64_t* grown = realloc(stats.latencies, maxLatencies * sizeof(int64_t));
+        if (grown == NULL) {
+            return;
+        }
+        stats.latencies = grown;
+        stats.maxLatencies = maxLatencies;
+    }
+    stats.latencies[stats.nLatencies++] = latency;
+}
+
+/**************** report ****************/
+/*
+ * Prints what the run achieved: players joined, messages and bytes per
+ * second in each direction, and percentiles of key-to-display latency
+ */
+void
+report(const double elapsed)
+{
+    static const char* patterns[] = { "random", "gold", "sprint" };
+    printf("%d bots, %s pattern, %.1f keys/s each, ran %.2f s%s\n",
+           options.players, patterns[options.pattern], options.rate, elapsed,
+           stats.gameOver ? " (game over)" : "");
+    printf("joined %d, refused %d\n", stats.joined, stats.refused);
+    printf("sent     %8ld keys      %10.1f/s\n", stats.keys, stats.keys / elapsed);
+    printf("received %8ld messages  %10.1f/s  (%ld DISPLAY, %ld GOLD)\n",
+           stats.messages, stats.messages / elapsed, stats.displays, stats.golds);
+    printf("received %8.1f kB       %10.1f kB/s\n",
+           stats.bytes / 1e3, stats.bytes / 1e3 / elapsed);
+
+    if (stats.nLatencies == 0) {
+        printf("key-to-display latency: no samples (%ld moves unanswered)\n", stats.unanswered);
+        return;
+    }
+    printf("moves with no effect %ld, moves not matched to a display %ld\n", stats.ineffective, stats.unmatched);
+    qsort(stats.latencies, stats.nLatencies, sizeof(int64_t), compareTimes);
+    const int64_t* sorted = stats.latencies;
+    const long n = stats.nLatencies;
+    printf("key-to-display latency, ms (%ld samples, %ld moves unanswered):\n", n, stats.unanswered);
+    printf("  p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+           sorted[n * 50 / 100] / 1e6, sorted[n * 90 / 100] / 1e6, sorted[n * 99 / 100] / 1e6,
+           sorted[n * 999 / 1000] / 1e6, sorted[n - 1] / 1e6);
+}
+
+/**************** compareTimes ****************/
+/*
+ * qsort comparison for int64_t times, smallest first
+ */
+int
+compareTimes(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
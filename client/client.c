@@ -16,8 +16,13 @@
 #include <ncurses.h> 
 #include <unistd.h>
 #include <signal.h>  
+#include <getopt.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include "../support/message.h"
 #include "../support/log.h"
+#include "../lib/timing.h"
+#include "predict.h"
 
 bool parseArgs(const int argc, char* argv[], char** hostname, char** port, char** playername);
 bool handleInput(void* arg);
@@ -28,7 +33,13 @@ void handle_quit(const char* message);
 void handle_error(const char* message);
 void initDisplay();
 void duplicate_str(const char*);
+const char* next_line(const char* text, int* length);
 bool handleTimeout(void* arg);
+void send_viewport(const addr_t server);
+void show_display(const char* display);
+void draw_status(void);
+void send_ping(const addr_t server);
+void handle_pong(const char* message);
 
 // helper struct to hold all the client info we need throughout the program
 typedef struct client_info{
@@ -36,18 +47,42 @@ typedef struct client_info{
     int display_nc;
     int map_nr;
     int map_nc;
+    bool clipped;
     int collected;
     int purse;
     int remaining;
     char* playername;
     char playerletter;
     char* last_display;
+    size_t last_display_size;
     bool gold_update;
     bool timeout_on;
+    predict_t* predict;     // with --predict, once the map size is known
+    int64_t last_ping;      // when the last PING went out
+    int64_t rtt[8];         // the latest latencySamples round-trip times, in ns
+    int64_t held[8];        // and how long the server held each ping
+    int n_samples;          // samples taken; the latest is at n_samples % 8
 } client_info_t;
 
 client_info_t* client_info;
 
+// settings from the command line
+static struct {
+    bool predict;           // move our own '@' before the server confirms it
+    bool latency;           // measure round trips and show them in the status line
+} options;
+
+// seconds to wait for the server to answer a predicted move
+static const double predictTimeout = 1.0;
+
+// seconds between latency probes, and how many recent ones are averaged
+static const double pingInterval = 1.0;
+static const int latencySamples = 8;
+
+// seconds between a spectator's pings without --latency; the server
+// drops spectators it has not heard from in a minute
+static const double keepaliveInterval = 20.0;
+
 /**************** main ****************/
 /* 
  * takes in commmand line arguments and calls helper functions to do rest
@@ -57,10 +92,10 @@ main(int argc, char* argv[])
 {
     char* hostname;
     char* port;
-    char* playername = (argc == 4) ? argv[3] : NULL;
+    char* playername;
 
     if (!parseArgs(argc, argv, &hostname, &port, &playername)) {
-        printf("Usage: ./client hostname port [playername]\n");
+        printf("Usage: ./client [--predict] [--latency] hostname port [playername]\n");
         return 1;
     }
 
@@ -84,6 +119,7 @@ main(int argc, char* argv[])
     message_done();
     endwin();
     free(client_info->last_display);
+    predict_delete(client_info->predict);
     free(client_info);
    
     return ok? 0 : 2;
@@ -114,7 +150,7 @@ handleMessage(void* arg, const addr_t from, const char* message)
     
     } else if (strcmp(messageType, "GRID") == 0){
         
-        // if the message is GRID, store the grid size + validate that display size is at least that
+        // if the message is GRID, store the grid size, and ask for a window onto it if it won't fit
         
         int nrows, ncols;
         sscanf(message, "%*s %d %d", &nrows, &ncols);
@@ -124,26 +160,11 @@ handleMessage(void* arg, const addr_t from, const char* message)
         
         // get curr display size
         getmaxyx(stdscr, client_info->display_nr, client_info->display_nc);
+        send_viewport(from);
 
-        // don't let the user proceed until the display is at least as large as the size of the grid
-        while (nrows +1 > client_info->display_nr || ncols > client_info->display_nc) {
-            
-            clear();
-            mvprintw(0, 0, "Your window must be at least %d high", nrows+1);
-            mvprintw(1, 0, "Your window must be at least %d wide", ncols);
-            mvprintw(3, 0, "Current size: %d (height) x %d (width)", client_info->display_nr, client_info->display_nc);
-            mvprintw(2, 0, "Resize your window, and press Enter to continue.");
-           
-            refresh();
-
-            while (getch() != '\n') {
-                // Wait for Enter key press
-            }
-
-            // get the update display size
-            getmaxyx(stdscr, client_info->display_nr, client_info->display_nc);
-            refresh();
-
+        // only players move, so only players predict
+        if (options.predict && client_info->playername != NULL && client_info->predict == NULL) {
+            client_info->predict = predict_new(nrows, ncols);
         }
         
     } else if (strcmp(messageType, "GOLD") == 0){
@@ -154,16 +175,11 @@ handleMessage(void* arg, const addr_t from, const char* message)
 
     } else if (strcmp(messageType, "DISPLAY") == 0){
         
-        // if message is DISPLAY, call handle display with the message
-        handle_display(message);
-
-        // update last_display only when the message starts with "DISPLAY"
-        // this way we can come back to the last known display at any point 
-        const char* prefix = "DISPLAY";
-        
-        if (strncmp(message, prefix, strlen(prefix)) == 0) {
-            
-            duplicate_str(message); 
+        // if message is DISPLAY, show it, with any moves still awaiting the server
+        if (client_info->predict != NULL) {
+            show_display(predict_reconcile(client_info->predict, message));
+        } else {
+            show_display(message);
         }
 
     } else if (strcmp(messageType, "QUIT") == 0){
@@ -173,6 +189,11 @@ handleMessage(void* arg, const addr_t from, const char* message)
         // return true to exit the message loop
         return true;
     
+    } else if (strcmp(messageType, "PONG") == 0) {
+
+        // if message is PONG, note the round trip and show it
+        handle_pong(message);
+
     } else if (strcmp(messageType, "ERROR") == 0) {
 
         // if message is ERROR, call handle error with the message to take care of it
@@ -184,6 +205,8 @@ handleMessage(void* arg, const addr_t from, const char* message)
         mvprintw(0, 0, "Server message: %s", message);
     }
 
+    send_ping(from);
+
     // return false to keep the message looop going
     return false;
 }
@@ -268,13 +291,44 @@ handleTimeout(void* arg)
         return true;
     }
 
+    send_ping(*(addr_t*) arg);
+
+    // a predicted move the server never answered is shown as the server has it
+    if (client_info->predict != NULL) {
+        const char* display = predict_expire(client_info->predict, predictTimeout);
+        if (display != NULL) {
+            show_display(display);
+        }
+    }
+
     // return false otherwise to keep going
     return false;
 }
 
+/**************** show_display ****************/
+/* 
+ * Shows a display, and keeps it as the last display (what is on screen)
+ * 
+ * Caller provides:
+ *   the DISPLAY message
+ * We return:
+ *   nothing
+ */
+void
+show_display(const char* display)
+{
+    handle_display(display);
+    duplicate_str(display);
+}
+
+
 /**************** handle_display ****************/
 /* 
- * Takes in the messsage and prints out the display and status line 
+ * Takes in the messsage and prints out the display and status line.
+ * Only the cells that differ from the last display (last_display,
+ * which is what is on the screen) are redrawn; all changes reach the
+ * terminal in one doupdate. If there is no last display, the whole
+ * map is drawn.
  * 
  * Caller provides:
  *   the message
@@ -285,22 +339,67 @@ void
 handle_display(const char* message)
 {
 
-    // skip the "DISPLAY" part of the message
-    const char* gridString = message + strlen("DISPLAY\n");
+    // a clipped display says where its window is: "DISPLAY top left"
+    int top, left;
+    client_info->clipped = (sscanf(message, "DISPLAY %d %d", &top, &left) == 2);
 
-    // clear the window and move to the top-left corner
-    clear();
-    move(1, 0);
-        
-    // printw("%.*s", client_info->display_nc, gridString);  // Print one line
+    // skip the header lines of the new display and of the one on screen
+    const char* previous = client_info->last_display;
+    const char* newLine = strchr(message, '\n');
+    const char* oldLine = (previous != NULL) ? strchr(previous, '\n') : NULL;
+    if (previous == NULL) {
+        clear();
+    }
 
-    while (*gridString != '\0')
-    {
-        printw("%.*s", client_info->display_nc, gridString);  // Print one line
-        gridString += client_info->display_nc;  // Move to the next line
+    // compare line by line, below the status line, redrawing only changed cells
+    for (int row = 1; row < client_info->display_nr; row++) {
+        int newLength = 0;
+        int oldLength = 0;
+        newLine = next_line(newLine, &newLength);
+        oldLine = next_line(oldLine, &oldLength);
+        if (newLine == NULL && oldLine == NULL) {
+            break;
+        }
+
+        int width = (newLength > oldLength) ? newLength : oldLength;
+        if (width > client_info->display_nc) {
+            width = client_info->display_nc;
+        }
+        for (int col = 0; col < width; col++) {
+            char cell = (col < newLength) ? newLine[col] : ' ';
+            char shown = (col < oldLength) ? oldLine[col] : ' ';
+            if (cell != shown || previous == NULL) {
+                mvaddch(row, col, cell);
+            }
+        }
+        newLine = (newLine != NULL) ? newLine + newLength : NULL;
+        oldLine = (oldLine != NULL) ? oldLine + oldLength : NULL;
     }
 
     // update status line
+    draw_status();
+    client_info->gold_update = false;
+    
+    // send every change to the terminal at once
+    wnoutrefresh(stdscr);
+    doupdate();
+    
+}
+
+
+/**************** draw_status ****************/
+/* 
+ * Draws the status line at the top of the screen, with the round-trip
+ * latency if measuring it; the caller refreshes the screen
+ * 
+ * Caller provides:
+ *   nothing
+ * We return:
+ *   nothing
+ */
+void
+draw_status(void)
+{
     char statusLine[256];
     
     if (client_info->playername != NULL) {
@@ -308,7 +407,6 @@ handle_display(const char* message)
         if (client_info->gold_update){
             snprintf(statusLine, sizeof(statusLine), "Player %c has %d nuggets (%d nuggets unclaimed). %d collected",
                  client_info->playerletter, client_info->purse, client_info->remaining, client_info->collected);
-                 client_info->gold_update = false;
 
         } else {
             snprintf(statusLine, sizeof(statusLine), "Player %c has %d nuggets (%d nuggets unclaimed).",
@@ -322,10 +420,83 @@ handle_display(const char* message)
     move(0, 0);
     clrtoeol();
     mvprintw(0, 0, "%s", statusLine);
-    
-    // refresh the window to show the changes
-    refresh();
-    
+
+    // averaging the latest round trips, and the server's share of them
+    int n = (client_info->n_samples < latencySamples) ? client_info->n_samples : latencySamples;
+    if (options.latency && n > 0) {
+        int64_t rtt = 0;
+        int64_t held = 0;
+        for (int i = 0; i < n; i++) {
+            rtt += client_info->rtt[i];
+            held += client_info->held[i];
+        }
+        printw("  [rtt %.1f ms, server %.2f ms]", timing_seconds(rtt / n) * 1e3, timing_seconds(held / n) * 1e3);
+    }
+}
+
+
+/**************** send_ping ****************/
+/* 
+ * With --latency, sends the server a PING if one is due, carrying the
+ * time it was sent (echoed back in the PONG) and the average round trip
+ * so far, which the server records; a spectator, who otherwise sends
+ * nothing, pings now and then anyway to show they are still watching
+ * 
+ * Caller provides:
+ *   the server's address
+ * We return:
+ *   nothing
+ */
+void
+send_ping(const addr_t server)
+{
+    int64_t now = timing_now();
+    bool spectating = (client_info->playername == NULL);
+    if (!options.latency && !spectating) {
+        return;
+    }
+    double interval = options.latency ? pingInterval : keepaliveInterval;
+    if (timing_seconds(now - client_info->last_ping) < interval) {
+        return;
+    }
+    client_info->last_ping = now;
+
+    int n = (client_info->n_samples < latencySamples) ? client_info->n_samples : latencySamples;
+    int64_t rtt = 0;
+    for (int i = 0; i < n; i++) {
+        rtt += client_info->rtt[i];
+    }
+
+    char message[message_MaxBytes];
+    snprintf(message, message_MaxBytes, "PING %" PRId64 " %" PRId64, now, (n > 0) ? rtt / n : 0);
+    message_send(server, message);
+}
+
+
+/**************** handle_pong ****************/
+/* 
+ * Takes in a PONG, "PONG sent held", and records the round trip since
+ * 'sent' and the time 'held' by the server, then redraws the status line
+ * 
+ * Caller provides:
+ *   the message
+ * We return:
+ *   nothing
+ */
+void
+handle_pong(const char* message)
+{
+    int64_t sent, held;
+    if (sscanf(message, "PONG %" SCNd64 " %" SCNd64, &sent, &held) != 2) {
+        return;
+    }
+    int latest = client_info->n_samples++ % latencySamples;
+    client_info->rtt[latest] = timing_now() - sent;
+    client_info->held[latest] = held;
+
+    draw_status();
+    wnoutrefresh(stdscr);
+    doupdate();
 }
 
 
@@ -390,6 +561,18 @@ handleInput(void* arg) {
     // read a single character of input using getch()
     int ch = getch();  
 
+    // the terminal was resized: ask for a window that fits it
+    if (ch == KEY_RESIZE) {
+        getmaxyx(stdscr, client_info->display_nr, client_info->display_nc);
+
+        // what was on screen is no longer to be trusted; redraw in full next time
+        free(client_info->last_display);
+        client_info->last_display = NULL;
+        client_info->last_display_size = 0;
+        send_viewport(*server);
+        return false;
+    }
+
     // check if the character is a newline (Enter key)
     if (ch == '\n') {
 
@@ -403,12 +586,57 @@ handleInput(void* arg) {
 
     // send the message to the server
     message_send(*server, message);
+
+    send_ping(*server);
+
+    // then show the move straight away, if it can be predicted
+    if (client_info->predict != NULL) {
+        const char* display = predict_expire(client_info->predict, predictTimeout);
+        if (display != NULL) {
+            show_display(display);
+        }
+        display = predict_key(client_info->predict, ch);
+        if (display != NULL) {
+            show_display(display);
+        }
+    }
     
     // normal case: keep looping
     return false;
 }
 
 
+/**************** send_viewport ****************/
+/* 
+ * Tells the server how many rows and columns of the map fit on the
+ * screen, below the status line, if the whole map does not; the server
+ * then sends only that window of the map.
+ * 
+ * Caller provides:
+ *   the server's address
+ * We return:
+ *   nothing
+ */
+void
+send_viewport(const addr_t server)
+{
+    int rows = client_info->display_nr - 1;
+    int cols = client_info->display_nc;
+
+    // nothing to ask for until the map size is known, or if the map fits
+    if (client_info->map_nr == 0 || rows < 1 || cols < 1) {
+        return;
+    }
+    if (rows >= client_info->map_nr && cols >= client_info->map_nc && !client_info->clipped) {
+        return;
+    }
+
+    char message[message_MaxBytes];
+    snprintf(message, message_MaxBytes, "VIEWPORT %d %d", rows, cols);
+    message_send(server, message);
+}
+
+
 /**************** server_setup ****************/
 /* 
  * Uses the hostname and port to create a connection with the server and sends an 
@@ -465,24 +693,48 @@ bool
 parseArgs(const int argc, char* argv[], char** hostname, char** port, char** playername) 
 {
     
-    // check number of arguments
-    if (argc < 3 || argc > 4) {
+    static const struct option longOptions[] = {
+        { "predict", no_argument, NULL, 'p' },
+        { "latency", no_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    options.predict = false;
+    options.latency = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "pl", longOptions, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                options.predict = true;
+                break;
+            case 'l':
+                options.latency = true;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    // check number of positional arguments
+    int remaining = argc - optind;
+    if (remaining < 2 || remaining > 3) {
         return false;
     }
 
     // store hostmae
-    *hostname = argv[1];
+    *hostname = argv[optind];
 
     // make sure port is a number
-    if (atoi(argv[2]) == 0 ) {
+    if (atoi(argv[optind + 1]) == 0 ) {
         return false;
     }
 
     // store port
-    *port = argv[2];
+    *port = argv[optind + 1];
 
     // if playername provided, store it, otherwise it's nun for spectator
-    *playername = (argc == 4) ? argv[3] : NULL;
+    *playername = (remaining == 3) ? argv[optind + 2] : NULL;
 
     // if we get here, valid arguments
     return true;
@@ -529,27 +781,53 @@ initDisplay()
 
 /**************** duplicate_str ****************/
 /* 
- * duplicates string. We use to to keep a copy of the latest display
+ * duplicates string. We use to to keep a copy of the latest display;
+ * the copy's buffer is reused while it is large enough
  * 
  * Caller provides:
  *   the string to duplicate
  * We return:
- *   pointer to a string
+ *   nothing
  */
 void 
 duplicate_str(const char* str) 
 {
-    if (client_info->last_display != NULL) {
-        free(client_info->last_display); 
-    }
-
     // get the length of the string, including the null terminator
     size_t len = strlen(str) + 1;  
-    // allocate memory for the new string
-    client_info->last_display = malloc(len);  
+
+    // allocate memory for the new string, unless the last copy has room
+    if (client_info->last_display_size < len) {
+        free(client_info->last_display); 
+        client_info->last_display = malloc(len);  
+        client_info->last_display_size = (client_info->last_display != NULL) ? len : 0;
+    }
 
     if (client_info->last_display != NULL) {
         // copy the string to the newly allocated memory
         memcpy(client_info->last_display, str, len);  
     }
 }
+
+
+/**************** next_line ****************/
+/* 
+ * steps to the next line of a display
+ * 
+ * Caller provides:
+ *   the newline that ends the previous line (or NULL), and where to put the length
+ * We return:
+ *   the start of the next line, with its length (excluding the newline) in *length;
+ *   NULL, with *length 0, if there is no next line
+ */
+const char*
+next_line(const char* text, int* length)
+{
+    *length = 0;
+    if (text == NULL || text[0] == '\0' || text[1] == '\0') {
+        return NULL;
+    }
+    const char* line = text + 1;
+    const char* end = strchr(line, '\n');
+    *length = (end != NULL) ? end - line : strlen(line);
+    return line;
+}
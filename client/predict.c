@@ -0,0 +1,366 @@
+/*
+ * predict.c - Nuggets client's 'predict' module
+ *
+ * see predict.h for more information.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+#include "predict.h"
+#include "../lib/timing.h"
+
+/**************** local constants ****************/
+static const int maxMoves = 32;     // moves that may await the server at once
+
+/**************** local types ****************/
+typedef struct move {
+    char key;
+    int row;            // where the move was predicted to leave the player,
+    int col;            //   in map coordinates
+    int64_t sent;       // when the key was sent
+} move_t;
+
+// one DISPLAY message, with the geometry needed to find a point in it
+typedef struct frame {
+    char* body;         // first row of the map, just past the header line
+    int top;            // map coordinates of the first row and column
+    int left;
+    int width;          // points per row; each row is followed by a newline
+    int height;
+} frame_t;
+
+typedef struct predict {
+    int mapRows;
+    int mapCols;
+    char* under;        // what lies beneath each map point, 0 if never seen
+    char* server;       // the server's last DISPLAY
+    size_t serverSize;
+    char* shown;        // that DISPLAY with the pending moves applied
+    size_t shownSize;
+    move_t* moves;      // oldest first
+    int nMoves;
+    int baseRow;        // where the server had the player before the
+    int baseCol;        //   first pending move
+} predict_t;
+
+/**************** local functions ****************/
+static bool copyText(char** buffer, size_t* size, const char* text);
+static bool parseFrame(char* display, frame_t* frame);
+static bool findSelf(const frame_t* frame, int* row, int* col);
+static void remember(predict_t* predict, const frame_t* frame);
+static bool applyMove(predict_t* predict, frame_t* frame, const char key, int* row, int* col);
+static bool keyDirection(const char key, int* changeRow, int* changeCol);
+
+/**************** predict_new ****************/
+/* see predict.h for description */
+predict_t*
+predict_new(const int mapRows, const int mapCols)
+{
+    predict_t* predict = calloc(1, sizeof(predict_t));
+    if (predict == NULL) {
+        return NULL;
+    }
+    predict->mapRows = mapRows;
+    predict->mapCols = mapCols;
+    predict->under = calloc(mapRows * mapCols, sizeof(char));
+    predict->moves = calloc(maxMoves, sizeof(move_t));
+    if (predict->under == NULL || predict->moves == NULL) {
+        predict_delete(predict);
+        return NULL;
+    }
+    return predict;
+}
+
+/**************** predict_key ****************/
+/* see predict.h for description */
+const char*
+predict_key(predict_t* predict, const char key)
+{
+    int changeRow, changeCol;
+    if (predict->server == NULL || predict->nMoves == maxMoves
+        || !keyDirection(key, &changeRow, &changeCol)) {
+        return NULL;
+    }
+
+    // predicting on top of the moves already pending, or else the server's display
+    frame_t frame;
+    if (predict->nMoves == 0) {
+        if (!copyText(&predict->shown, &predict->shownSize, predict->server)
+            || !parseFrame(predict->shown, &frame)
+            || !findSelf(&frame, &predict->baseRow, &predict->baseCol)) {
+            return NULL;
+        }
+        predict->baseRow += frame.top;
+        predict->baseCol += frame.left;
+    } else if (!parseFrame(predict->shown, &frame)) {
+        return NULL;
+    }
+
+    // every move key is recorded, even one that cannot be predicted, so
+    // that the pending moves line up with what the server will do
+    move_t* move = &predict->moves[predict->nMoves++];
+    move->key = key;
+    move->sent = timing_now();
+    bool moved = applyMove(predict, &frame, key, &move->row, &move->col);
+    return moved ? predict->shown : NULL;
+}
+
+/**************** predict_reconcile ****************/
+/* see predict.h for description */
+const char*
+predict_reconcile(predict_t* predict, const char* display)
+{
+    frame_t frame;
+    if (!copyText(&predict->server, &predict->serverSize, display)
+        || !parseFrame(predict->server, &frame)) {
+        predict->nMoves = 0;
+        return display;
+    }
+    remember(predict, &frame);
+    if (predict->nMoves == 0) {
+        return predict->server;
+    }
+
+    // where the server has the player now
+    int row, col;
+    if (!findSelf(&frame, &row, &col)) {
+        predict->nMoves = 0;
+        return predict->server;
+    }
+    row += frame.top;
+    col += frame.left;
+
+    // the server has applied the moves up to the latest one that left the
+    // player here; if none did, and the player has not moved, it has
+    // applied none yet; otherwise the prediction was wrong
+    int applied = -1;
+    for (int i = predict->nMoves - 1; i >= 0 && applied < 0; i--) {
+        if (predict->moves[i].row == row && predict->moves[i].col == col) {
+            applied = i + 1;
+        }
+    }
+    if (applied < 0) {
+        if (row != predict->baseRow || col != predict->baseCol) {
+            predict->nMoves = 0;
+            return predict->server;
+        }
+        applied = 0;
+    }
+    predict->nMoves -= applied;
+    memmove(predict->moves, predict->moves + applied, predict->nMoves * sizeof(move_t));
+    predict->baseRow = row;
+    predict->baseCol = col;
+    if (predict->nMoves == 0) {
+        return predict->server;
+    }
+
+    // replaying the moves still pending on the server's display
+    frame_t shown;
+    if (!copyText(&predict->shown, &predict->shownSize, predict->server)
+        || !parseFrame(predict->shown, &shown)) {
+        predict->nMoves = 0;
+        return predict->server;
+    }
+    for (int i = 0; i < predict->nMoves; i++) {
+        move_t* move = &predict->moves[i];
+        applyMove(predict, &shown, move->key, &move->row, &move->col);
+    }
+    return predict->shown;
+}
+
+/**************** predict_expire ****************/
+/* see predict.h for description */
+const char*
+predict_expire(predict_t* predict, const double seconds)
+{
+    if (predict->nMoves > 0
+        && timing_seconds(timing_now() - predict->moves[0].sent) > seconds) {
+        predict->nMoves = 0;
+        return predict->server;
+    }
+    return NULL;
+}
+
+/**************** predict_delete ****************/
+/* see predict.h for description */
+void
+predict_delete(predict_t* predict)
+{
+    if (predict != NULL) {
+        free(predict->under);
+        free(predict->server);
+        free(predict->shown);
+        free(predict->moves);
+        free(predict);
+    }
+}
+
+/**************** copyText ****************/
+/* Copy the text into the buffer, growing the buffer if it is too small.
+ * Return false if out of memory.
+ */
+static bool
+copyText(char** buffer, size_t* size, const char* text)
+{
+    size_t length = strlen(text) + 1;
+    if (*size < length) {
+        char* grown = realloc(*buffer, length);
+        if (grown == NULL) {
+            return false;
+        }
+        *buffer = grown;
+        *size = length;
+    }
+    memcpy(*buffer, text, length);
+    return true;
+}
+
+/**************** parseFrame ****************/
+/* Find the rows of the map in a DISPLAY message, and the map coordinates
+ * of its window ("DISPLAY top left"; 0 0 for a full display).
+ * Return false if the message has no rows.
+ */
+static bool
+parseFrame(char* display, frame_t* frame)
+{
+    frame->top = 0;
+    frame->left = 0;
+    sscanf(display, "DISPLAY %d %d", &frame->top, &frame->left);
+
+    char* body = strchr(display, '\n');
+    if (body == NULL || body[1] == '\0') {
+        return false;
+    }
+    frame->body = body + 1;
+
+    char* end = strchr(frame->body, '\n');
+    if (end == NULL) {
+        return false;
+    }
+    frame->width = end - frame->body;
+    frame->height = strlen(frame->body) / (frame->width + 1);
+    return frame->width > 0;
+}
+
+/**************** findSelf ****************/
+/* Find the player's '@' in the frame, in frame coordinates.
+ * Return false if it is not there.
+ */
+static bool
+findSelf(const frame_t* frame, int* row, int* col)
+{
+    char* at = strchr(frame->body, '@');
+    if (at == NULL) {
+        return false;
+    }
+    int offset = at - frame->body;
+    *row = offset / (frame->width + 1);
+    *col = offset % (frame->width + 1);
+    return *row < frame->height;
+}
+
+/**************** remember ****************/
+/* Note what the frame shows of the ground beneath each point; gold will
+ * have been picked up by whoever later stands on it.
+ */
+static void
+remember(predict_t* predict, const frame_t* frame)
+{
+    for (int row = 0; row < frame->height; row++) {
+        const char* line = frame->body + row * (frame->width + 1);
+        int mapRow = row + frame->top;
+        if (mapRow < 0 || mapRow >= predict->mapRows) {
+            continue;
+        }
+        for (int col = 0; col < frame->width; col++) {
+            int mapCol = col + frame->left;
+            if (mapCol >= 0 && mapCol < predict->mapCols) {
+                char ground = line[col];
+                if (ground == '.' || ground == '#') {
+                    predict->under[mapRow * predict->mapCols + mapCol] = ground;
+                } else if (ground == '*') {
+                    predict->under[mapRow * predict->mapCols + mapCol] = '.';
+                }
+            }
+        }
+    }
+}
+
+/**************** applyMove ****************/
+/* Move the '@' in the frame as the server would for this key: one step,
+ * or for an upper-case key as many as possible, into points known to be
+ * open. A player in the way trades places. Leaves the player's final
+ * position, in map coordinates, in *row and *col.
+ * Return true if the '@' moved.
+ */
+static bool
+applyMove(predict_t* predict, frame_t* frame, const char key, int* row, int* col)
+{
+    int r, c;
+    if (!findSelf(frame, &r, &c)) {
+        *row = -1;
+        *col = -1;
+        return false;
+    }
+
+    int changeRow, changeCol;
+    bool moved = false;
+    keyDirection(key, &changeRow, &changeCol);
+    do {
+        int toRow = r + changeRow;
+        int toCol = c + changeCol;
+        if (toRow < 0 || toRow >= frame->height || toCol < 0 || toCol >= frame->width) {
+            break;
+        }
+        char* to = frame->body + toRow * (frame->width + 1) + toCol;
+        if (*to != '.' && *to != '#' && *to != '*' && !isupper(*to)) {
+            break;
+        }
+
+        // leaving behind the player we trade places with, or the ground
+        char* from = frame->body + r * (frame->width + 1) + c;
+        if (isupper(*to)) {
+            *from = *to;
+        } else {
+            int mapRow = r + frame->top;
+            int mapCol = c + frame->left;
+            char ground = predict->under[mapRow * predict->mapCols + mapCol];
+            *from = (ground != 0) ? ground : '.';
+        }
+        *to = '@';
+        r = toRow;
+        c = toCol;
+        moved = true;
+    } while (isupper(key));
+
+    *row = r + frame->top;
+    *col = c + frame->left;
+    return moved;
+}
+
+/**************** keyDirection ****************/
+/* Translate a movement key into the change in row and column of one
+ * step. Return false if the key is not a movement key.
+ */
+static bool
+keyDirection(const char key, int* changeRow, int* changeCol)
+{
+    switch (tolower(key)) {
+        case 'h': *changeRow =  0; *changeCol = -1; break;
+        case 'l': *changeRow =  0; *changeCol =  1; break;
+        case 'j': *changeRow =  1; *changeCol =  0; break;
+        case 'k': *changeRow = -1; *changeCol =  0; break;
+        case 'y': *changeRow = -1; *changeCol = -1; break;
+        case 'u': *changeRow = -1; *changeCol =  1; break;
+        case 'b': *changeRow =  1; *changeCol = -1; break;
+        case 'n': *changeRow =  1; *changeCol =  1; break;
+        default: return false;
+    }
+    return true;
+}
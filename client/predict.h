@@ -0,0 +1,71 @@
+/*
+ * predict.h - header file for the Nuggets client's 'predict' module
+ *
+ * Movement prediction hides the round trip to the server: when the
+ * player presses a movement key, the client moves its own '@' at once,
+ * on a copy of the last display from the server, and sends the key as
+ * usual. When the server's next DISPLAY arrives, it is reconciled with
+ * the moves still pending: moves the server has already applied are
+ * dropped, the rest are replayed on top of the server's display, and
+ * if the server disagrees with the prediction (another player got in
+ * the way, or a key was lost) the prediction is abandoned and the
+ * server's display is shown as is.
+ *
+ * Prediction uses only what the display shows. A move is predicted
+ * only into a point known to be open: a room spot, a passage, gold, or
+ * another player (with whom the server swaps places). What lies
+ * beneath the player is remembered from earlier displays.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#ifndef _PREDICT_H_
+#define _PREDICT_H_
+
+#include <stdbool.h>
+
+/**************** global types ****************/
+typedef struct predict predict_t;  // opaque to users of the module
+
+/**************** predict_new ****************/
+/* Create a predictor for a map of the given size (from GRID).
+ * We return:
+ *   the predictor; NULL if out of memory.
+ * Caller is responsible for calling predict_delete later.
+ */
+predict_t* predict_new(const int mapRows, const int mapCols);
+
+/**************** predict_key ****************/
+/* Predict the effect of a keystroke the player is about to send.
+ * We return:
+ *   the predicted DISPLAY message, in a buffer owned by the predictor
+ *   and valid until the next call; NULL if the key is not a move, or
+ *   no move can be predicted (nothing known to be open that way, no
+ *   display yet, or too many moves already pending).
+ */
+const char* predict_key(predict_t* predict, const char key);
+
+/**************** predict_reconcile ****************/
+/* Reconcile a DISPLAY message from the server with the pending moves.
+ * We return:
+ *   the DISPLAY message to show: the server's own, or a copy of it
+ *   with the still-pending moves replayed, owned by the predictor and
+ *   valid until the next call.
+ */
+const char* predict_reconcile(predict_t* predict, const char* display);
+
+/**************** predict_expire ****************/
+/* Abandon pending moves the server has not answered within 'seconds'
+ * (the key was lost, or the server saw no change).
+ * We return:
+ *   the server's last DISPLAY, to show instead of the prediction, if
+ *   any moves were abandoned; NULL otherwise.
+ */
+const char* predict_expire(predict_t* predict, const double seconds);
+
+/**************** predict_delete ****************/
+/* Free the predictor and everything it holds.
+ */
+void predict_delete(predict_t* predict);
+
+#endif // _PREDICT_H_
@@ -6,6 +6,9 @@
  * Binary Brigade, Spring, 2023
  */
 
+// allocations here are counted against the game subsystem (see mem.h)
+#define MEM_SUBSYSTEM mem_game
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,21 +17,48 @@
 #include "../grid/grid.h"
 #include "../player/player.h"
 #include "../lib/mem.h"
+#include "../outbox/outbox.h"
+#include "../render/render.h"
+#include "../lib/timing.h"
+#include "../lib/scratch.h"
+#include "../lib/trace.h"
+#include "../stats/stats.h"
 #include "game.h"
 
 /**************** local global types ****************/
 static const int goldTotal = 250;
 static const int maxPlayers = 26;
 static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static const int initialSpectators = 8;
+static const int spectatorLimit = 1024;
+static const double spectatorSilence = 60;  // seconds unheard before a spectator is dropped
+static const double silenceSweep = 1;       // seconds between checks for silent spectators
 
 /**************** global types ****************/
+typedef struct spectator {
+  addr_t address;
+  int64_t interval;     // least nanoseconds between frames; 0 if uncapped
+  int64_t lastFrame;    // when the last frame was queued for them
+  int64_t lastHeard;    // when they last sent anything
+  int behindAt;         // position in the behind list, or -1 if not behind
+  viewport_t view;      // the part of the map they asked to see
+} spectator_t;
+
 typedef struct game{
   grid_t* grid;
   int totalGold;
   int goldAvailable;
   int playerCount;
   player_t** players;
-  addr_t spectator;
+  viewport_t* views;    // each player's window, indexed like players
+  spectator_t* spectators;
+  int spectatorCount;
+  int maxSpectators;
+  int* spectatorIndex;  // hash table of spectator numbers, -1 where empty
+  int indexSize;        // twice maxSpectators, a power of two
+  int* behind;          // numbers of the spectators a frame is waiting for
+  int behindCount;
+  int64_t nextSweep;    // when to next look for silent spectators
 } game_t;
 
 /**************** static functions ****************/
@@ -36,6 +66,18 @@ static bool movePossible(player_t* player, int changeRow, int changeColumn);
 static void executeMovement(player_t* player, int changeRow, int changeColumn);
 static void foundPlayer(player_t* player, gridpoint_t* current, gridpoint_t* updated);
 static void foundGold(player_t* player);
+static bool keyDirection(char letter, int* changeRow, int* changeColumn);
+static spectator_t* findSpectator(addr_t address);
+static void indexSpectators(void);
+static void unindexSpectator(int number);
+static void removeSpectatorAt(int number);
+static void markBehind(spectator_t* spectator);
+static void markCaughtUp(spectator_t* spectator);
+static void dropSilentSpectators(int64_t now);
+static void sendSpectatorFrame(spectator_t* spectator, const char* frame, int64_t now);
+static const char* buildSummary(void);
+static void seeFrom(player_t* player);
+static const char* renderSpectator(void);
 
 
 game_t* game;
@@ -43,9 +85,9 @@ game_t* game;
 /**************** FUNCTION ****************/
 /* see game.h for description */
 void 
-initialize_game(grid_t* grid)
+initialize_game(grid_t* grid, mem_arena_t* arena)
 {
-  game = mem_malloc(sizeof(game_t));
+  game = mem_arena_alloc(arena, sizeof(game_t));
 
   if (game == NULL) {
     return;              
@@ -55,13 +97,30 @@ initialize_game(grid_t* grid)
     game->totalGold = goldTotal;
     game->goldAvailable = goldTotal;
     game->playerCount = 0;
-    player_t** players = calloc(maxPlayers, sizeof(player_t*));
-    game->players = players;
-    game->spectator = message_noAddr();
+    game->players = mem_arena_calloc_assert(arena, maxPlayers, sizeof(player_t*), "players");
+    game->views = mem_arena_calloc_assert(arena, maxPlayers, sizeof(viewport_t), "viewports");
+    // the spectators array grows, so it stays on the heap
+    game->spectators = mem_malloc_assert(initialSpectators * sizeof(spectator_t), "spectators");
+    game->spectatorCount = 0;
+    game->maxSpectators = initialSpectators;
+    game->spectatorIndex = NULL;
+    indexSpectators();
+    game->behind = mem_malloc_assert(initialSpectators * sizeof(int), "behind spectators");
+    game->behindCount = 0;
+    game->nextSweep = 0;
+    render_init();
   }
 
 }
 
+/**************** FUNCTION ****************/
+/* see game.h for description */
+bool
+game_full()
+{
+  return game->playerCount == maxPlayers;
+}
+
 /**************** FUNCTION ****************/
 /* see game.h for description */
 int
@@ -88,10 +147,9 @@ placePlayer(player_t* player)
 
         gridpoint_t* randomPoint = getPoint(randRow, randColumn);
                 
-        /* If the random location is in a room or passage, and if there is not
-        already a player in the spot */
-        if ((getTerrain(randomPoint) == '.') || (((getTerrain(randomPoint) == '#')) &&
-            getPlayer(randomPoint) == 0)) {
+        /* If the random location is an empty spot in a room (not already
+        holding a player) */
+        if ((getTerrain(randomPoint) == '.') && !isalpha(getPlayer(randomPoint))) {
             // Inserting the player into random point
             setPlayer(randomPoint, get_letter(player));
           
@@ -114,74 +172,10 @@ movePlayer(player_t* player, char letter)
   int changeRow;
   int changeColumn;
     
-  // Setting up the switch to handle each character press
-  switch (letter) {
-    case 'h': 
-      changeRow = 0;
-      changeColumn = -1;
-      break;
-    case 'l': 
-      changeRow = 0;
-      changeColumn = 1;
-      break;
-    case 'j': 
-      changeRow = 1;
-      changeColumn = 0;
-      break;
-    case 'k': 
-      changeRow = -1;
-      changeColumn = 0;
-      break;
-    case 'y': 
-      changeRow = -1;
-      changeColumn = -1;
-      break;
-    case 'u': 
-      changeRow = -1;
-      changeColumn = 1;
-      break;
-    case 'b': 
-      changeRow = 1;
-      changeColumn = -1;
-      break;
-    case 'n': 
-      changeRow = 1;
-      changeColumn = 1;
-      break;
-    case 'H': 
-      changeRow = 0;
-      changeColumn = -1;
-      break;
-    case 'L': 
-      changeRow = 0;
-      changeColumn = 1;
-      break;
-    case 'J': 
-      changeRow = 1;
-      changeColumn = 0;
-      break;
-    case 'K': 
-      changeRow = -1;
-      changeColumn = 0;
-      break;
-    case 'Y': 
-      changeRow = -1;
-      changeColumn = -1;
-      break;
-    case 'U': 
-      changeRow = -1;
-      changeColumn = 1;
-      break;
-    case 'B': 
-      changeRow = 1;
-      changeColumn = -1;
-      break;
-    case 'N': 
-      changeRow = 1;
-      changeColumn = 1;
-      break;
-    default: return;
+  if (!keyDirection(letter, &changeRow, &changeColumn)) {
+    return;
   }
+  int64_t start = trace_now();
 
   // If the letter is uppercase (continuous movement)
   if (isupper(letter)) {
@@ -197,6 +191,57 @@ movePlayer(player_t* player, char letter)
           executeMovement(player, changeRow, changeColumn);
       }
   }
+  trace_span("movePlayer", start);
+}
+
+/**************** bot_nextKey ****************/
+/* See detailed description in game.h. */
+char
+bot_nextKey(player_t* bot)
+{
+  static const char* keys = "hljkyubn";
+  int best = gridGoldDistance(get_y(bot), get_x(bot));
+  char key = '\0';
+  if (best <= 0) {
+    return key;
+  }
+
+  // Stepping to the neighbour closest to gold; the first found wins ties
+  for (int i = 0; keys[i] != '\0'; i++) {
+    int changeRow, changeColumn;
+    keyDirection(keys[i], &changeRow, &changeColumn);
+    int distance = gridGoldDistance(get_y(bot) + changeRow, get_x(bot) + changeColumn);
+    if (distance >= 0 && distance < best) {
+      best = distance;
+      key = keys[i];
+    }
+  }
+  return key;
+}
+
+/**************** keyDirection ****************/
+/* Function translates a movement key into the
+ * change in row and column of one step in that
+ * direction; upper and lower case give the
+ * same step. Returns false if the letter is not
+ * a movement key.
+ */
+static bool
+keyDirection(char letter, int* changeRow, int* changeColumn)
+{
+  // Setting up the switch to handle each character press
+  switch (tolower(letter)) {
+    case 'h': *changeRow =  0; *changeColumn = -1; break;
+    case 'l': *changeRow =  0; *changeColumn =  1; break;
+    case 'j': *changeRow =  1; *changeColumn =  0; break;
+    case 'k': *changeRow = -1; *changeColumn =  0; break;
+    case 'y': *changeRow = -1; *changeColumn = -1; break;
+    case 'u': *changeRow = -1; *changeColumn =  1; break;
+    case 'b': *changeRow =  1; *changeColumn = -1; break;
+    case 'n': *changeRow =  1; *changeColumn =  1; break;
+    default: return false;
+  }
+  return true;
 }
 
 /**************** movePossible ****************/
@@ -217,6 +262,11 @@ movePossible(player_t* player, int changeRow, int changeColumn)
 
     // Potential new location of the player
     gridpoint_t* updated = getPoint( (getPointRow(current) + changeRow), (getPointColumn(current) + changeColumn) );
+
+    // If the new position is off the edge of the map
+    if (updated == NULL) {
+        return false;
+    }
     
     /* If the new position is either a spot in a room, passage, or
     contains gold */
@@ -262,8 +312,10 @@ executeMovement(player_t* player, int changeRow, int changeColumn)
   // Checking if the move causes the player to find gold
   foundGold(player);
 
-  // Updating the visibility
-  updateVisibility(player);
+  // Updating the visibility; bots see nothing, so they need none
+  if (!isBot(player)) {
+    seeFrom(player);
+  }
 }
 
 /**************** foundGold ****************/
@@ -311,8 +363,8 @@ foundPlayer(player_t* player, gridpoint_t* current, gridpoint_t* updated)
     if (isalpha(getPlayer(updated))) {
         // Looping through the players in the game to find the player
         for (int i = 0; players[i] != NULL; i++) {
-            // If the coordinates of the new position match the player
-            if ((getPointColumn(updated) == get_x(players[i])) && 
+            // If the coordinates of the new position match an active player
+            if (isActive(players[i]) && (getPointColumn(updated) == get_x(players[i])) && 
                 (getPointRow(updated) == get_y(players[i]))) {
                 // Setting these coordinates to be those of current
                 set_x(players[i], getPointColumn(current));
@@ -335,85 +387,57 @@ foundPlayer(player_t* player, gridpoint_t* current, gridpoint_t* updated)
 void 
 gridDisplay(addr_t address, player_t* player) 
 {
-  // Size of grid string: rows*columns, plus one newline per row, plus one for null pointer
-  char* gridString = mem_calloc(((getnRows(game->grid))*(getnColumns(game->grid)+ 1) + 1), sizeof(char));
-  int index = 0;
-
   // Checking if the grid is NULL
   if (game->grid != NULL) {
-    updateVisibility(player);
-    // Looping over rows and columns in the grid
-    for (int row = 0; row < getnRows(game->grid); row++) {
-      for (int column = 0; column < getnColumns(game->grid); column++) {
-        char terrain = getTerrain(getPoint(row, column));
-        char playerAtPoint = getPlayer(getPoint(row, column));
-
-        // Point contains a player
-        if (isalpha(playerAtPoint)) {
-          if (isVisible(player, row, column)) {
-
-            // If the player at the point is the player itself, print @ sign
-            if (playerAtPoint == get_letter(player)) {
-                gridString[index] = '@';
-                index++;
-            } else {
-              gridString[index] = playerAtPoint;
-              index++;
-            }
-            
-          }
-          else if (isKnown(player, row, column)) {
-            gridString[index] = terrain;
-            index++;
-          }
-          else {
-            gridString[index] = ' ';
-            index++;
-          }
-        }
-        // Point does not contain a player
-        else {
-          // Tile contains gold
-           if (terrain == '*' ) {
-            if (isVisible(player, row, column)) {
-              gridString[index] = terrain;
-              index++;
-            }
-            else if (isKnown(player, row, column)) {
-              gridString[index] = '.';
-              index++;
-            }
-            else {
-              gridString[index] = ' ';
-              index++;
-            }
-          }
-          // Tile does not contain gold
-          else {
-            if (isKnown(player, row, column)) {
-              gridString[index] = terrain;
-              index++;
-            }
-            else {
-              gridString[index] = ' ';
-              index++;
-            }
-          }
-        }     
-      }
-      // Printing newline for the next row
-      gridString[index] = '\n';
-      index++;
+    int64_t traced = trace_now();
+    seeFrom(player);
+    int64_t start = timing_now();
+    const char* frame = render_player(player, game->players, maxPlayers);
+    stats_phase(stats_render, timing_now() - start);
+    trace_span("render", start);
+
+    // A player with a viewport sees the window around them
+    viewport_t* view = &game->views[get_letter(player) - 'A'];
+    viewport_follow(view, get_y(player), get_x(player));
+    outbox_send(address, render_clip(frame, view));
+    trace_span("gridDisplay", traced);
+  }
+}
+
+/**************** displayChanged ****************/
+/* See game.h for description. */
+bool
+displayChanged(player_t* player)
+{
+  if (gridChangesOverflowed()) {
+    return true;
+  }
+
+  // Looping over the changed points, looking for one the player would notice
+  for (int i = 0; i < gridChangeCount(); i++) {
+    gridpoint_t* point = gridChangeAt(i);
+    int row = getPointRow(point);
+    int column = getPointColumn(point);
+
+    // The player's own spot changed (they moved, were swapped, or found gold)
+    if (row == get_y(player) && column == get_x(player)) {
+      return true;
+    }
+
+    // A point the player can currently see changed
+    if (isVisible(player, row, column)) {
+      return true;
     }
   }
-  
-  char* formattedDisplay = mem_malloc((strlen("DISPLAY \n") + strlen(gridString)) * sizeof(char) + 1);
-  strcpy(formattedDisplay, "DISPLAY \n");
-  strcat(formattedDisplay, gridString);
-  //sprintf(formattedDisplay, "DISPLAY \n%s", gridString);
-  message_send(address, formattedDisplay);
-  mem_free(formattedDisplay);
-  mem_free(gridString);
+  return false;
+}
+
+/**************** spectatorDisplayChanged ****************/
+/* See game.h for description. */
+bool
+spectatorDisplayChanged()
+{
+  return gridChangesOverflowed() || gridChangeCount() > 0;
 }
 
 /**************** gridDisplaySpectator ****************/
@@ -421,39 +445,83 @@ gridDisplay(addr_t address, player_t* player)
 void
 gridDisplaySpectator(addr_t address) 
 {
-  // Size of grid string: rows*columns, plus one newline per row, plus one for null pointerc
-  char* gridString = mem_calloc(((getnRows(game->grid))*(getnColumns(game->grid) + 1) + 1), sizeof(char));
-  int index = 0;
-
   // Checking if the grid is NULL
   if (game->grid != NULL) {
-    // Looping over rows and columns in the grid
-    for (int row = 0; row < getnRows(game->grid); row++) {
-      for (int column = 0; column < getnColumns(game->grid); column++) {
-        // If the point contains a player, printing the player letter
-        char playerAtPoint = getPlayer(getPoint(row, column));
-        if (isalpha(playerAtPoint)) {
-          gridString[index] = playerAtPoint;
-          index++;
-        }
+    const char* frame = renderSpectator();
+    spectator_t* spectator = findSpectator(address);
+    if (spectator != NULL) {
+      sendSpectatorFrame(spectator, frame, timing_now());
+    } else {
+      outbox_sendLive(address, frame);
+    }
+  }
+}
 
-        // If the point does not contain a player, printing the terrain
-        else {
-          char terrain = getTerrain(getPoint(row, column));
-          gridString[index] = terrain;
-          index++;
-        }
+/**************** gridDisplaySpectators ****************/
+/* See game.h for description. */
+void
+gridDisplaySpectators() 
+{
+  if (game->grid == NULL || game->spectatorCount == 0) {
+    return;
+  }
+
+  // Rendering once; every spectator's queue refers to the same frame
+  const char* frame = renderSpectator();
+  int64_t now = timing_now();
+  for (int i = 0; i < game->spectatorCount; i++) {
+    spectator_t* spectator = &game->spectators[i];
+    if (now - spectator->lastFrame >= spectator->interval) {
+      sendSpectatorFrame(spectator, frame, now);
+    } else {
+      markBehind(spectator);
+    }
+  }
+}
+
+/**************** flushSpectatorDisplays ****************/
+/* See game.h for description. */
+void
+flushSpectatorDisplays() 
+{
+  if (game->grid == NULL) {
+    return;
+  }
+  int64_t now = timing_now();
+  const char* frame = NULL;
+  // backwards, since a spectator caught up leaves the list in place of the last
+  for (int i = game->behindCount - 1; i >= 0; i--) {
+    spectator_t* spectator = &game->spectators[game->behind[i]];
+    if (now - spectator->lastFrame >= spectator->interval) {
+      if (frame == NULL) {
+        frame = renderSpectator();
       }
-      // Printing newline for the next row
-      gridString[index] = '\n';
-      index++;
+      sendSpectatorFrame(spectator, frame, now);
     }
   }
-  char* formattedDisplay = mem_malloc((strlen("DISPLAY \n") + strlen(gridString)) * sizeof(char) + 1);
-  sprintf(formattedDisplay, "DISPLAY \n%s", gridString);
-  message_send(address, formattedDisplay);
-  mem_free(formattedDisplay);
-  mem_free(gridString);
+
+  if (now >= game->nextSweep) {
+    game->nextSweep = now + silenceSweep * 1e9;
+    dropSilentSpectators(now);
+  }
+}
+
+/**************** spectators_behind ****************/
+/* See game.h for description. */
+bool
+spectators_behind()
+{
+  return game->behindCount > 0;
+}
+
+/**************** sendToSpectators ****************/
+/* See game.h for description. */
+void
+sendToSpectators(const char* message) 
+{
+  for (int i = 0; i < game->spectatorCount; i++) {
+    outbox_send(game->spectators[i].address, message);
+  }
 }
 
 /**************** FUNCTION ****************/
@@ -478,21 +546,280 @@ find_player(addr_t address)
 
 /**************** FUNCTION ****************/
 /* see game.h for description */
-addr_t
-add_spectator(addr_t spectator)
+bool
+add_spectator(addr_t spectator, float maxFrameRate)
 {
-  addr_t pastSpectator = game->spectator;
-  game->spectator = spectator;
-  return pastSpectator;
+  spectator_t* existing = findSpectator(spectator);
+  if (existing == NULL) {
+    if (game->spectatorCount == spectatorLimit) {
+      return false;
+    }
+
+    // Growing the set, its index, and the behind list if needed
+    if (game->spectatorCount == game->maxSpectators) {
+      int maxSpectators = game->maxSpectators * 2;
+      spectator_t* spectators = mem_malloc_assert(maxSpectators * sizeof(spectator_t), "spectators");
+      memcpy(spectators, game->spectators, game->spectatorCount * sizeof(spectator_t));
+      mem_free(game->spectators);
+      game->spectators = spectators;
+      int* behind = mem_malloc_assert(maxSpectators * sizeof(int), "behind spectators");
+      memcpy(behind, game->behind, game->behindCount * sizeof(int));
+      mem_free(game->behind);
+      game->behind = behind;
+      game->maxSpectators = maxSpectators;
+      indexSpectators();
+    }
+    const int number = game->spectatorCount++;
+    existing = &game->spectators[number];
+    existing->address = spectator;
+    existing->lastFrame = 0;
+    existing->behindAt = -1;
+    existing->view = (viewport_t){ 0, 0, 0, 0 };
+
+    const int mask = game->indexSize - 1;
+    int bucket = message_hashAddr(spectator) & mask;
+    while (game->spectatorIndex[bucket] >= 0) {
+      bucket = (bucket + 1) & mask;
+    }
+    game->spectatorIndex[bucket] = number;
+  }
+
+  // A rejoining spectator keeps their place but may change their cap
+  existing->interval = (maxFrameRate > 0) ? (int64_t)(1e9 / maxFrameRate) : 0;
+  existing->lastHeard = timing_now();
+  return true;
 }
 
 /**************** FUNCTION ****************/
 /* see game.h for description */
-addr_t
-get_spectator()
+bool
+remove_spectator(addr_t spectator)
 {
-  addr_t pastSpectator = game->spectator;
-  return pastSpectator;
+  spectator_t* found = findSpectator(spectator);
+  if (found == NULL) {
+    return false;
+  }
+  removeSpectatorAt(found - game->spectators);
+  return true;
+}
+
+/**************** FUNCTION ****************/
+/* see game.h for description */
+void
+spectator_heard(addr_t address)
+{
+  spectator_t* spectator = findSpectator(address);
+  if (spectator != NULL) {
+    spectator->lastHeard = timing_now();
+  }
+}
+
+/**************** FUNCTION ****************/
+/* see game.h for description */
+bool
+is_spectator(addr_t address)
+{
+  return findSpectator(address) != NULL;
+}
+
+/**************** FUNCTION ****************/
+/* see game.h for description */
+int
+spectator_count()
+{
+  return game->spectatorCount;
+}
+
+/**************** FUNCTION ****************/
+/* see game.h for description */
+bool
+set_viewport(addr_t address, int rows, int cols)
+{
+  player_t* player = find_player(address);
+  if (player != NULL) {
+    viewport_t* view = &game->views[get_letter(player) - 'A'];
+    viewport_resize(view, rows, cols);
+    // Centering the new window on the player, then clamping it to the map
+    view->top = get_y(player) - view->rows / 2;
+    view->left = get_x(player) - view->cols / 2;
+    viewport_pan(view, 0, 0);
+    return true;
+  }
+
+  spectator_t* spectator = findSpectator(address);
+  if (spectator != NULL) {
+    viewport_resize(&spectator->view, rows, cols);
+    return true;
+  }
+  return false;
+}
+
+/**************** FUNCTION ****************/
+/* see game.h for description */
+bool
+pan_spectator(addr_t address, char key)
+{
+  spectator_t* spectator = findSpectator(address);
+  int changeRow;
+  int changeColumn;
+  if (spectator == NULL || !keyDirection(key, &changeRow, &changeColumn)) {
+    return false;
+  }
+
+  // Upper case moves by half a window
+  if (isupper(key)) {
+    changeRow *= spectator->view.rows / 2;
+    changeColumn *= spectator->view.cols / 2;
+  }
+  return viewport_pan(&spectator->view, changeRow, changeColumn);
+}
+
+/**************** findSpectator ****************/
+/* Returns the spectator with the given address,
+ * or NULL if there is none, by hashing the address
+ * as the outbox does.
+ */
+static spectator_t*
+findSpectator(addr_t address)
+{
+  const int mask = game->indexSize - 1;
+  int bucket = message_hashAddr(address) & mask;
+  while (game->spectatorIndex[bucket] >= 0) {
+    spectator_t* spectator = &game->spectators[game->spectatorIndex[bucket]];
+    if (message_eqAddr(address, spectator->address)) {
+      return spectator;
+    }
+    bucket = (bucket + 1) & mask;
+  }
+  return NULL;
+}
+
+/**************** indexSpectators ****************/
+/* (Re)builds the hash table over the spectators,
+ * sized for maxSpectators.
+ */
+static void
+indexSpectators(void)
+{
+  if (game->spectatorIndex != NULL) {
+    mem_free(game->spectatorIndex);
+  }
+  game->indexSize = 2 * game->maxSpectators;
+  game->spectatorIndex = mem_malloc_assert(game->indexSize * sizeof(int), "spectator index");
+  for (int i = 0; i < game->indexSize; i++) {
+    game->spectatorIndex[i] = -1;
+  }
+
+  const int mask = game->indexSize - 1;
+  for (int i = 0; i < game->spectatorCount; i++) {
+    int bucket = message_hashAddr(game->spectators[i].address) & mask;
+    while (game->spectatorIndex[bucket] >= 0) {
+      bucket = (bucket + 1) & mask;
+    }
+    game->spectatorIndex[bucket] = i;
+  }
+}
+
+/**************** unindexSpectator ****************/
+/* Removes the given spectator from the hash table,
+ * shifting back any later entries of its probe run
+ * that would otherwise no longer be found.
+ */
+static void
+unindexSpectator(int number)
+{
+  const int mask = game->indexSize - 1;
+  int hole = message_hashAddr(game->spectators[number].address) & mask;
+  while (game->spectatorIndex[hole] != number) {
+    hole = (hole + 1) & mask;
+  }
+
+  for (int next = (hole + 1) & mask; game->spectatorIndex[next] >= 0; next = (next + 1) & mask) {
+    int home = message_hashAddr(game->spectators[game->spectatorIndex[next]].address) & mask;
+    // the entry stays put if its home lies cyclically in (hole, next]
+    bool stays = hole <= next ? (hole < home && home <= next)
+                              : (hole < home || home <= next);
+    if (!stays) {
+      game->spectatorIndex[hole] = game->spectatorIndex[next];
+      hole = next;
+    }
+  }
+  game->spectatorIndex[hole] = -1;
+}
+
+/**************** removeSpectatorAt ****************/
+/* Removes the spectator with the given number,
+ * moving the last spectator into their place.
+ */
+static void
+removeSpectatorAt(int number)
+{
+  markCaughtUp(&game->spectators[number]);
+  unindexSpectator(number);
+
+  const int last = --game->spectatorCount;
+  if (number != last) {
+    spectator_t* moved = &game->spectators[number];
+    *moved = game->spectators[last];
+
+    // Pointing the index and the behind list at the new place
+    const int mask = game->indexSize - 1;
+    int bucket = message_hashAddr(moved->address) & mask;
+    while (game->spectatorIndex[bucket] != last) {
+      bucket = (bucket + 1) & mask;
+    }
+    game->spectatorIndex[bucket] = number;
+    if (moved->behindAt >= 0) {
+      game->behind[moved->behindAt] = number;
+    }
+  }
+}
+
+/**************** markBehind ****************/
+/* Puts the spectator on the behind list, if not
+ * already there.
+ */
+static void
+markBehind(spectator_t* spectator)
+{
+  if (spectator->behindAt < 0) {
+    spectator->behindAt = game->behindCount;
+    game->behind[game->behindCount++] = spectator - game->spectators;
+  }
+}
+
+/**************** markCaughtUp ****************/
+/* Takes the spectator off the behind list, moving
+ * the last entry into their place.
+ */
+static void
+markCaughtUp(spectator_t* spectator)
+{
+  if (spectator->behindAt >= 0) {
+    const int last = game->behind[--game->behindCount];
+    game->behind[spectator->behindAt] = last;
+    game->spectators[last].behindAt = spectator->behindAt;
+    spectator->behindAt = -1;
+  }
+}
+
+/**************** dropSilentSpectators ****************/
+/* Says goodbye to every spectator not heard from
+ * in spectatorSilence seconds, and forgets them.
+ */
+static void
+dropSilentSpectators(int64_t now)
+{
+  // backwards, since a spectator removed is replaced by the last
+  for (int i = game->spectatorCount - 1; i >= 0; i--) {
+    spectator_t* spectator = &game->spectators[i];
+    if (timing_seconds(now - spectator->lastHeard) >= spectatorSilence) {
+      addr_t address = spectator->address;
+      removeSpectatorAt(i);
+      outbox_send(address, "QUIT Timed out: nothing heard from you in a minute.");
+      outbox_forget(address);
+    }
+  }
 }
 
 /**************** FUNCTION ****************/
@@ -503,20 +830,17 @@ get_grid_dimensions(addr_t address)
   int rows = getnRows(game->grid);
   int columns = getnColumns(game->grid);
 
-  char dimensions[100];
-  sprintf(dimensions, "GRID %d %d", rows, columns);
-  message_send(address, dimensions);
+  outbox_send(address, scratch_printf("GRID %d %d", rows, columns));
 }
 
 /**************** FUNCTION ****************/
 /* see game.h for description */
 int
-game_inactive_player(game_t* game, player_t* player)
+game_inactive_player(player_t* player)
 {
   for (int i = 0; i < game->playerCount; i++) {
     player_t* currPlayer = game->players[i];
     if (player == currPlayer){
-      setPlayer(getPoint(get_y(player), get_x(player)), '0');
       player_inactive(currPlayer);
       return 0;
     }
@@ -558,33 +882,86 @@ get_available_gold()
 void
 game_summary(addr_t address)
 {
-  char summary[65507];
+  outbox_send(address, buildSummary());
+}
+
+/**************** FUNCTION ****************/
+/* see game.h for description */
+void
+game_summarySpectators()
+{
+  if (game->spectatorCount > 0) {
+    sendToSpectators(buildSummary());
+  }
+}
+
+/**************** seeFrom ****************/
+/* Updates the player's visibility, timing it for the server's stats
+ * and trace.
+ */
+static void
+seeFrom(player_t* player)
+{
+  int64_t start = timing_now();
+  updateVisibility(player);
+  stats_phase(stats_visibility, timing_now() - start);
+  trace_span("updateVisibility", start);
+}
+
+/**************** renderSpectator ****************/
+/* Renders the spectator frame, timing it for the server's stats and
+ * trace.
+ */
+static const char*
+renderSpectator(void)
+{
+  int64_t start = timing_now();
+  const char* frame = render_spectator(game->players, maxPlayers);
+  stats_phase(stats_render, timing_now() - start);
+  trace_span("render_spectator", start);
+  return frame;
+}
 
+/**************** sendSpectatorFrame ****************/
+/* Queues the spectator frame for the spectator:
+ * the shared frame itself if they see the whole
+ * map, otherwise their own window cut out of it.
+ */
+static void
+sendSpectatorFrame(spectator_t* spectator, const char* frame, int64_t now)
+{
+  if (spectator->view.rows > 0) {
+    outbox_send(spectator->address, render_clip(frame, &spectator->view));
+  } else {
+    outbox_sendLive(spectator->address, frame);
+  }
+  spectator->lastFrame = now;
+  markCaughtUp(spectator);
+}
+
+/**************** buildSummary ****************/
+/* Builds the game-over message, one line per
+ * player, in scratch memory.
+ */
+static const char*
+buildSummary(void)
+{
   // Inserting GAME OVER as opening line for the summary
-  strcpy(summary, "QUIT GAME OVER:\n");
+  scratch_msg_t* summary = scratch_msg("QUIT GAME OVER:\n");
 
   // Looping over the players in the game, adding their information to summary
   for (int i = 0; i < game->playerCount; i++) {
     player_t* currPlayer = game->players[i];
-
-    // Saving player information in variable currLine
-
-    char currLine[100]; 
     char letter = get_letter(currPlayer);
     int playerGold = get_gold(currPlayer);
     char* name = get_name(currPlayer);
 
-    sprintf(currLine, "%c   %3d %s\n", letter, playerGold, name);
-    
-    // Adding information to summary string
-    strcat(summary, currLine);
-
+    scratch_append(summary, "%c   %3d %s\n", letter, playerGold, name);
   }
 
   // Adding newline to end of summary for clean look
-  strcat(summary, "\n");
-
-  message_send(address, summary);
+  scratch_append(summary, "\n");
+  return scratch_text(summary);
 }
 
 /* see game.h for description */
@@ -597,8 +974,12 @@ delete_game()
       player_delete(game->players[i]);
     }
 
-    free(game->players);
-    free(game);
+    render_delete();
+    mem_free(game->spectators);
+    mem_free(game->spectatorIndex);
+    mem_free(game->behind);
+    // the rest belongs to the match's arena
+    game = NULL;
   }
 }
 
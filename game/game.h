@@ -11,31 +11,91 @@
 typedef struct game game_t;  // opaque to users of the module
 
 /**************** FUNCTION ****************/
-/* Create a new game structure w/ given grid parameter
+/* Create a new game structure w/ given grid parameter, allocated from
+ * the match's arena (which the caller deletes after delete_game)
  *
  * We return:
  *   pointer to a new game; NULL if error (out of memory).
  */
-void initialize_game(grid_t* grid);
+void initialize_game(grid_t* grid, mem_arena_t* arena);
 
 /**************** gridDisplay ****************/
-/* The function takes in a player, creates a 
-*  string to display the player-specific grid.
-*  Upon checking that the grid is not NULL, 
-*  it loops over each point in the grid, printing
+/* The function takes in a player and sends them
+*  the player-specific display of the grid.
+*  Upon checking that the grid is not NULL, it
+*  brings the player's visibility up to date and
+*  has the render module build the frame, showing
 *  players/gold/terrain/empty spaces based on
 *  what is known and visible to the player.
+*  A player who set a viewport is sent only the
+*  window around them, which scrolls as they
+*  near its edges.
 */
 void gridDisplay(addr_t address, player_t* player);
 
 /**************** gridDisplaySpectator ****************/
-/* The function creates a string to display the
+/* The function sends the display of the whole
  * grid. It is designed for the spectator mode, meaning
- * that the function has full visibility of the grid
- * as well as the gold and players in it.  
+ * that the display has full visibility of the grid
+ * as well as the gold and players in it. Used for a
+ * new spectator's first frame, which is never held
+ * back by their frame-rate cap.
  */
 void gridDisplaySpectator(addr_t address); 
 
+/**************** gridDisplaySpectators ****************/
+/* The function renders the spectator display once
+ * and queues that same frame for every spectator.
+ * A spectator whose frame-rate cap does not yet
+ * allow another frame is marked as behind instead,
+ * and caught up by flushSpectatorDisplays.
+ */
+void gridDisplaySpectators();
+
+/**************** flushSpectatorDisplays ****************/
+/* The function sends the current spectator display
+ * to each spectator who is behind and whose cap now
+ * allows a frame; only those behind are looked at.
+ * About once a second it also drops spectators who
+ * have gone silent. Meant to be called from the
+ * event loop, after every event.
+ */
+void flushSpectatorDisplays();
+
+/**************** spectators_behind ****************/
+/* The function tells whether any spectator is
+ * waiting for their frame-rate cap to allow the
+ * newest frame, which flushSpectatorDisplays will
+ * send once it does.
+ */
+bool spectators_behind();
+
+/**************** sendToSpectators ****************/
+/* The function queues the message for every
+ * spectator.
+ */
+void sendToSpectators(const char* message);
+
+/**************** displayChanged ****************/
+/* The function tells whether the player's display
+ * would differ from the last one sent, given the
+ * points changed since the grid's change log was
+ * last cleared: true if the player's own spot
+ * changed (they moved, were swapped, or found
+ * gold) or any changed point is visible to them.
+ * Players whose view did not change need no new
+ * display.
+ */
+bool displayChanged(player_t* player);
+
+/**************** spectatorDisplayChanged ****************/
+/* The function tells whether any point changed
+ * since the grid's change log was last cleared;
+ * the spectator sees everything, so any change
+ * needs a new display.
+ */
+bool spectatorDisplayChanged();
+
 /**************** movePlayer ****************/
 /* The function handles the overall
  * functionality related to moving a player
@@ -55,6 +115,15 @@ void gridDisplaySpectator(addr_t address);
  */
 void movePlayer(player_t* player, char letter);
 
+/**************** bot_nextKey ****************/
+/* The function chooses a bot's next move: a
+ * single step towards the nearest gold pile,
+ * following the grid's distance field. Returns
+ * the movement key, or '\0' if no gold can be
+ * reached from where the bot stands.
+ */
+char bot_nextKey(player_t* bot);
+
 /**************** placePlayer ****************/
 /* Function takes in a player struct, placing
  * it into the map (either in an empty room
@@ -62,6 +131,12 @@ void movePlayer(player_t* player, char letter);
  */
 void placePlayer(player_t* player);
 
+/**************** FUNCTION ****************/
+/* Returns true if no more players can join (maxPlayers reached), so
+ * that no player is made, in the arena, only to be turned away.
+ */
+bool game_full();
+
 /**************** FUNCTION ****************/
 /* Add a new player to the game
  *
@@ -82,22 +157,72 @@ int add_player(player_t* player);
 player_t* find_player(addr_t address);
 
 /**************** FUNCTION ****************/
-/* Add a new spectator to the game
+/* Add a spectator to the game's set of
+ * spectators, who are sent at most
+ * maxFrameRate displays per second (no limit
+ * if 0). A spectator already in the set just
+ * gets the new limit.
  *
  * We return:
- *   NULL if no previous spectator;
- *   old spectator's address if previous spectator.
+ *   true if success; false if the set is full.
  */
-addr_t add_spectator(addr_t spectator);
+bool add_spectator(addr_t spectator, float maxFrameRate);
 
 /**************** FUNCTION ****************/
-/* Get spectator's address from the game
+/* Remove a spectator from the game
  *
  * We return:
- *   NULL if no previous spectator;
- *   spectator's address if exists
+ *   true if success; false if no such spectator.
  */
-addr_t get_spectator();
+bool remove_spectator(addr_t spectator);
+
+/**************** FUNCTION ****************/
+/* Note that a message came from the address,
+ * if it is a spectator's. A spectator not heard
+ * from in a minute is sent QUIT and dropped (see
+ * flushSpectatorDisplays), so clients that only
+ * watch must send something, such as a PING, now
+ * and then.
+ */
+void spectator_heard(addr_t address);
+
+/**************** FUNCTION ****************/
+/* Check whether an address is a spectator's
+ *
+ * We return:
+ *   true if the address belongs to a spectator.
+ */
+bool is_spectator(addr_t address);
+
+/**************** FUNCTION ****************/
+/* Set the viewport of the player or spectator
+ * with the given address: from then on they
+ * are sent only a window of rows x cols points
+ * (the whole map again if it fits). A player's
+ * window is centred on them.
+ *
+ * We return:
+ *   true if success; false if no such client.
+ */
+bool set_viewport(addr_t address, int rows, int cols);
+
+/**************** FUNCTION ****************/
+/* Pan a spectator's viewport in the direction
+ * of a movement key: one point for lower case,
+ * half a window for upper case.
+ *
+ * We return:
+ *   true if their window moved.
+ */
+bool pan_spectator(addr_t address, char key);
+
+/**************** FUNCTION ****************/
+/* Get the number of spectators
+ *
+ * We return:
+ *   the number of spectators in the game.
+ */
+int spectator_count();
 
 /**************** FUNCTION ****************/
 /* Gets the grid dimensions of the game
@@ -108,12 +233,14 @@ addr_t get_spectator();
 void get_grid_dimensions();
 
 /**************** FUNCTION ****************/
-/* Sets player as inactive in game
+/* Sets player as inactive in game, and takes
+ * their letter off the grid so that every
+ * display stops showing them
  *
  * We return:
  *   0 if success; 1 if error (no matching player)
  */
-int game_inactive_player(game_t* game, player_t* player);
+int game_inactive_player(player_t* player);
 
 /**************** FUNCTION ****************/
 /* Update gold count in game
@@ -151,8 +278,15 @@ int  get_available_gold();
  */
 void game_summary(addr_t address);
 
-/* Take in a pointer to a game and frees each player in the 
- * array, then the space for the array and the game itself.
+/**************** FUNCTION ****************/
+/* Sends the game summary, built once, to
+ * every spectator.
+ */
+void game_summarySpectators();
+
+/* Take in a pointer to a game and frees what each player holds on the
+ * heap, the renderer, and the spectators; the players, the array and
+ * the game itself go when the match's arena is deleted.
  *
  * We return:
  *   nothing
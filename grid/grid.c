@@ -6,6 +6,9 @@
  * Binary Brigade, Spring 2023
  */
 
+// allocations here are counted against the grid subsystem (see mem.h)
+#define MEM_SUBSYSTEM mem_grid
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -24,12 +27,28 @@ typedef struct gridpoint {
   int nGold;
   char player;
   char terrain;
+  bool changed;       // already in the change log
 } gridpoint_t;
 
 typedef struct grid {
     int nRows;
     int nColumns;
-    gridpoint_t*** points;
+    gridpoint_t* points;      // nRows*nColumns gridpoints, row by row
+    unsigned long version;    // count of changes since gridInit
+    unsigned long logVersion; // version when the change log was last cleared
+    gridpoint_t** changes;    // points changed since the last gridClearChanges
+    int nChanges;
+    bool overflowed;          // more points changed than the log holds
+    int* goldDistance;        // per point: steps to the nearest gold, -1 if none
+    int* frontier;            // queue for the breadth-first search over points
+    int* repairQueue;         // second queue, for repairing goldDistance
+    int* seeds;               // repair's starting points, nearest first
+    bool* repairing;          // points whose distance is being repaired
+    int* nearestGold;         // per point: the point of the gold it is nearest, -1 if none
+    unsigned char* openNeighbours; // per point: bit d set if neighbour d is walkable
+    int neighbourOffset[8];   // index change to each of the eight neighbours
+    bool neighboursStale;     // walkable terrain changed since openNeighbours was built
+    bool distanceStale;       // gold appeared since goldDistance was built
 } grid_t;
 
 /**************** global variables ****************/
@@ -37,127 +56,144 @@ grid_t* grid;
 
 /**************** global constants ****************/
 int TotalGold = 250;
+static const int maxChanges = 512;
 
 /**************** functions ****************/
 /**************** global functions ****************/
 
-grid_t* gridInit(char* pathName, int randomSeed);
+grid_t* gridInit(char* pathName, int randomSeed, mem_arena_t* arena);
 bool blocksVisibility(const int row, const int col);
 int getnRows();
 int getnColumns();
+gridpoint_t* getPoint(int row, int column);
 void gridDelete();
 
 /**************** local functions ****************/
 
-static gridpoint_t* gridpointNew(int row, int column, char terrain);
-static int readnColumns(FILE* map, int nRows); 
-static void insertGridpoints(char* pathName);
+static void gridpointInit(gridpoint_t* gridpoint, int row, int column, char terrain);
+static int measureMap(const char* text, const size_t length, int* nColumns);
+static void insertGridpoints(const char* text, const size_t length);
 static void generateGold(int randomSeed); 
+static void recordChange(gridpoint_t* gridpoint);
+static bool isWalkable(const char terrain);
+static void buildNeighbours(void);
+static void buildGoldDistance(void);
+static void repairGoldDistance(gridpoint_t* gridpoint);
+static int invalidateDistances(const int removed, int nSeeds[3]);
 
 
 /**************** gridInit ****************/
 /* See grid.h for description. */
 grid_t* 
-gridInit(char* pathName, int randomSeed) 
+gridInit(char* pathName, int randomSeed, mem_arena_t* arena) 
 {
-  // Allocating memory for the grid, checking for NULL pointer
-  grid = mem_malloc(sizeof(grid_t));
-
-  if (grid == NULL) {
-    return NULL;
-  }
-
-  // Opening the map file, checking for readability
+  // Reading the whole map file at once, checking for readability
   FILE* map = fopen(pathName, "r");
 
   if (map == NULL) {
     return NULL;
   }
+  size_t length;
+  char* text = file_readAll(map, &length);
+  fclose(map);
 
-  // Setting the number of columns and rows in the map
-  grid->nRows = file_numLines(map);
-  grid->nColumns = readnColumns(map, grid->nRows);
+  if (text == NULL) {
+    return NULL;
+  }
 
-  // Closing the file (to reset line count)
-  fclose(map);
+  // Allocating memory for the grid from the match's arena
+  grid = mem_arena_alloc_assert(arena, sizeof(grid_t), "grid");
 
-    /* Allocating memory for the rows and columns in the 
-    2D array to hold gridpoints */
-    grid->points = mem_malloc(grid->nRows * sizeof(gridpoint_t**));
+  // Setting the number of columns and rows in the map
+  grid->nRows = measureMap(text, length, &grid->nColumns);
 
-    // Allocating memory for the columns in each row
-    for (int row = 0; row < grid->nRows; row++) {
-        grid->points[row] = mem_malloc(grid->nColumns * sizeof(gridpoint_t*));
-    }
+  /* Allocating one contiguous block for the 2D array of 
+  gridpoints, stored row by row */
+  grid->points = mem_arena_alloc_assert(arena, grid->nRows * grid->nColumns * sizeof(gridpoint_t), "gridpoints");
 
-  // Creating gridpoints
-  insertGridpoints(pathName);
+  // Creating gridpoints, then letting go of the file's text
+  insertGridpoints(text, length);
+  free(text);
 
   // Generating the gold, inserting it into the map
   generateGold(randomSeed);
 
+  // Starting with an empty change log
+  grid->changes = mem_arena_alloc_assert(arena, maxChanges * sizeof(gridpoint_t*), "change log");
+  grid->nChanges = 0;
+  grid->overflowed = false;
+  grid->version = 0;
+  grid->logVersion = 0;
+
+  // The distance field is built when first asked for
+  const int nPoints = grid->nRows * grid->nColumns;
+  grid->goldDistance = mem_arena_alloc_assert(arena, nPoints * sizeof(int), "distance field");
+  grid->frontier = mem_arena_alloc_assert(arena, nPoints * sizeof(int), "distance frontier");
+  grid->repairQueue = mem_arena_alloc_assert(arena, nPoints * sizeof(int), "repair queue");
+  grid->seeds = mem_arena_alloc_assert(arena, nPoints * sizeof(int), "repair seeds");
+  grid->repairing = mem_arena_calloc_assert(arena, nPoints, sizeof(bool), "repair marks");
+  grid->nearestGold = mem_arena_alloc_assert(arena, nPoints * sizeof(int), "nearest gold");
+  grid->openNeighbours = mem_arena_alloc_assert(arena, nPoints, "neighbour masks");
+  grid->neighboursStale = true;
+  grid->distanceStale = true;
+
   // Returning a pointer to the initialized grid
   return grid;
 }
 
-/**************** readnColumns ****************/
-/* Returns the number of columns in a given map file. */
+/**************** measureMap ****************/
+/* Returns the number of rows in the text of a map
+*  file, a last line without a newline included, and
+*  sets *nColumns to the length of the longest row.
+*/
 static int 
-readnColumns(FILE* map, int nRows)
+measureMap(const char* text, const size_t length, int* nColumns)
 {
-  // Setting a variable for the number of columns
-  int nColumns = 0;
-
-  // Reading through the map to find nColumns
-  for (int row = 0; row < nRows; row++) {
-    // Reading the line, determining its length
-    char* line = file_readLine(map);
-    int length = strlen(line);
-
-    // If the length is greater than nColumns, updating the variable
-    if (nColumns < length) {
-      nColumns = length;
+  int nRows = 0;
+  *nColumns = 0;
+
+  // Walking the lines of the text, keeping the longest
+  file_lines_t lines;
+  file_startLines(&lines, text, length);
+  size_t lineLength;
+  while (file_nextLine(&lines, &lineLength) != NULL) {
+    nRows++;
+    if (*nColumns < (int)lineLength) {
+      *nColumns = lineLength;
     }
-
-    // Freeing memory allocated for the line
-    mem_free(line);
   }
 
-  // Returning the number of columns
-  return nColumns;
+  // Returning the number of rows
+  return nRows;
 }
 
 /**************** insertGridpoints ****************/
-/* The function takes the pathname for a map file.
+/* The function takes the text of a map file.
 *  Upon checking the parameters,
 *  the function loops through the map (rows and
-*  columns), creating and inserting a gridpoint
-*  struct into the 2D array belonging to the grid.
+*  columns), initializing each gridpoint
+*  struct in the 2D array belonging to the grid.
+*  Rows shorter than the longest are padded with
+*  solid rock.
 */
 static void 
-insertGridpoints(char* pathName)
+insertGridpoints(const char* text, const size_t length)
 {
-  // Opening the map file, checking for readability
-  FILE* map = fopen(pathName, "r");
-
-  if (map == NULL || grid == NULL) {
+  if (text == NULL || grid == NULL) {
     return;
   }
 
     // Looping through the map, inserting grid points
+    file_lines_t lines;
+    file_startLines(&lines, text, length);
     for (int row = 0; row < grid->nRows; row++) {
+        size_t lineLength;
+        const char* line = file_nextLine(&lines, &lineLength);
         for (int column = 0; column < grid->nColumns; column++) {
-            char terrain = fgetc(map);
-            gridpoint_t* gridpoint = gridpointNew(row, column, terrain);
-            grid->points[row][column] = gridpoint;
+            char terrain = (column < (int)lineLength) ? line[column] : ' ';
+            gridpointInit(getPoint(row, column), row, column, terrain);
         }
-        
-    // Moving to the next line
-    fgetc(map);
   }
-
-  // Closing the file
-  fclose(map);
 }
 
 /**************** gridDelete ****************/
@@ -165,56 +201,29 @@ insertGridpoints(char* pathName)
 void 
 gridDelete()
 {
-    // Only performing operations if the grid is not NULL
-    if (grid != NULL) {
-        // Freeing the memory allocated within the grid
-        for (int row = 0; row < grid->nRows; row++) {
-            for (int column = 0; column < grid->nColumns; column++) {
-                // Freeing the memory for the gridpoint
-                mem_free(grid->points[row][column]);
-            }
-
-            // Freeing the memory for the row
-            mem_free(grid->points[row]);
-        }
-
-  // Freeing the array and the grid itself
-  mem_free(grid->points);
-  mem_free(grid);
-  }
+  // Everything the grid holds belongs to the match's arena, which the
+  // caller deletes; here we only let go of it
+  grid = NULL;
 } 
 
-/**************** gridpointNew ****************/
-/* The functions takes in the coordinates of
- * the gridpoint (row, column) and the terrain
- * (what type of character is at the point).
- * It allocates memory for the gridpoint and 
- * sets the properties of the gridpoint
- * according to the parameters passed in. 
- * If the memory allocation is successful, it
- * returns a pointer to the gridpoint
- * (otherwise NULL).
+/**************** gridpointInit ****************/
+/* The functions takes in a gridpoint within the
+ * grid's array, the coordinates of the gridpoint
+ * (row, column) and the terrain (what type of
+ * character is at the point), and sets the
+ * properties of the gridpoint according to the
+ * parameters passed in. 
  */
-static gridpoint_t* 
-gridpointNew(int row, int column, char terrain)
+static void
+gridpointInit(gridpoint_t* gridpoint, int row, int column, char terrain)
 {
-  // Allocating memory for the gridpoint
-  gridpoint_t* gridpoint = mem_malloc(sizeof(gridpoint_t));
-
-  // Checking for successful memory allocation
-  if (gridpoint == NULL) {
-    return NULL;
-  }
-
   // Setting struct variables according to parameters
   gridpoint->row = row;
   gridpoint->column = column;
   gridpoint->terrain = terrain;
   gridpoint->nGold = 0;
   gridpoint->player = '0';
-
-  // Returning the created gridpoint
-  return gridpoint;
+  gridpoint->changed = false;
 }
 
 /**************** generateGold ****************/
@@ -264,16 +273,16 @@ generateGold(int randomSeed)
           int randColumn = ((rand() % (grid->nColumns)));
           
           // If the random location is in a room, inserting gold into it
-          if (grid->points[randRow][randColumn]->terrain == '.') {
+          if (getPoint(randRow, randColumn)->terrain == '.') {
               // If there is no gold in the spot currently
-              if (grid->points[randRow][randColumn]->nGold == 0) {
-                  grid->points[randRow][randColumn]->nGold = goldPile;
-                  grid->points[randRow][randColumn]->terrain = '*';
+              if (getPoint(randRow, randColumn)->nGold == 0) {
+                  getPoint(randRow, randColumn)->nGold = goldPile;
+                  getPoint(randRow, randColumn)->terrain = '*';
               } 
 
               // If there is already gold in the spot, adding to gold
               else {
-                  grid->points[randRow][randColumn]->nGold += goldPile;
+                  getPoint(randRow, randColumn)->nGold += goldPile;
               }
 
               // Updating the number of total gold to be distributed
@@ -291,7 +300,7 @@ generateGold(int randomSeed)
 bool 
 blocksVisibility(const int row, const int col)
 {
-  char terrain = grid->points[row][col]->terrain;
+  char terrain = getPoint(row, col)->terrain;
   if (terrain == '.' || terrain == '*') {
     return false;
   }
@@ -321,7 +330,10 @@ getnColumns()
 gridpoint_t* 
 getPoint(int row, int column)
 {
-  return grid->points[row][column];
+  if (row < 0 || row >= grid->nRows || column < 0 || column >= grid->nColumns) {
+    return NULL;
+  }
+  return &grid->points[row * grid->nColumns + column];
 }
 
 /**************** getTerrain ****************/
@@ -342,15 +354,27 @@ getPlayer(gridpoint_t* gridpoint)
 
 void setPlayer(gridpoint_t* gridpoint, char player)
 {
-  if (gridpoint != NULL) {
+  if (gridpoint != NULL && gridpoint->player != player) {
     gridpoint->player = player;
+    recordChange(gridpoint);
   }
 }
 
 void setTerrain(gridpoint_t* gridpoint, char terrain)
 {
-  if (gridpoint != NULL) {
+  if (gridpoint != NULL && gridpoint->terrain != terrain) {
+    const bool goldRemoved = (gridpoint->terrain == '*' && terrain != '*');
+    if (isWalkable(gridpoint->terrain) != isWalkable(terrain)) {
+      grid->neighboursStale = true;
+      grid->distanceStale = true;
+    } else if (terrain == '*') {
+      grid->distanceStale = true;
+    }
     gridpoint->terrain = terrain;
+    if (goldRemoved && !grid->distanceStale) {
+      repairGoldDistance(gridpoint);
+    }
+    recordChange(gridpoint);
   }
 }
 
@@ -380,7 +404,405 @@ int getPointGold(gridpoint_t* gridpoint)
 
 void setPointGold(gridpoint_t* gridpoint, int nGold)
 {
-  if (gridpoint != NULL) {
+  if (gridpoint != NULL && gridpoint->nGold != nGold) {
     gridpoint->nGold = nGold;
+    recordChange(gridpoint);
   }
 }
+
+/**************** gridChangeCount ****************/
+/* See grid.h for description. */
+int
+gridChangeCount()
+{
+  return grid->nChanges;
+}
+
+/**************** gridChangeAt ****************/
+/* See grid.h for description. */
+gridpoint_t*
+gridChangeAt(int index)
+{
+  if (index < 0 || index >= grid->nChanges) {
+    return NULL;
+  }
+  return grid->changes[index];
+}
+
+/**************** gridChangesOverflowed ****************/
+/* See grid.h for description. */
+bool
+gridChangesOverflowed()
+{
+  return grid->overflowed;
+}
+
+/**************** gridVersion ****************/
+/* See grid.h for description. */
+unsigned long
+gridVersion()
+{
+  return grid->version;
+}
+
+/**************** gridChangesSince ****************/
+/* See grid.h for description. */
+unsigned long
+gridChangesSince()
+{
+  return grid->logVersion;
+}
+
+/**************** gridClearChanges ****************/
+/* See grid.h for description. */
+void
+gridClearChanges()
+{
+  for (int i = 0; i < grid->nChanges; i++) {
+    grid->changes[i]->changed = false;
+  }
+  grid->nChanges = 0;
+  grid->overflowed = false;
+  grid->logVersion = grid->version;
+}
+
+/**************** gridGoldDistance ****************/
+/* See grid.h for description. */
+int
+gridGoldDistance(int row, int column)
+{
+  gridpoint_t* gridpoint = getPoint(row, column);
+  if (gridpoint == NULL) {
+    return -1;
+  }
+  if (grid->distanceStale) {
+    buildGoldDistance();
+  }
+  return grid->goldDistance[gridpoint - grid->points];
+}
+
+/**************** isWalkable ****************/
+/* Returns true if a player may stand on the terrain: a room spot,
+ * a passage, or gold.
+ */
+static bool
+isWalkable(const char terrain)
+{
+  return terrain == '.' || terrain == '#' || terrain == '*';
+}
+
+/**************** buildNeighbours ****************/
+/* Notes, for every point, which of its eight neighbours are on the
+ * grid and walkable, so the searches below can step from point to
+ * point by adding an offset instead of checking bounds and terrain.
+ */
+static void
+buildNeighbours(void)
+{
+  const int nColumns = grid->nColumns;
+  const int offsets[8] = { -nColumns - 1, -nColumns, -nColumns + 1, -1,
+                           1, nColumns - 1, nColumns, nColumns + 1 };
+  memcpy(grid->neighbourOffset, offsets, sizeof(offsets));
+
+  for (int row = 0; row < grid->nRows; row++) {
+    for (int column = 0; column < nColumns; column++) {
+      unsigned char open = 0;
+      int bit = 0;
+      for (int changeRow = -1; changeRow <= 1; changeRow++) {
+        for (int changeColumn = -1; changeColumn <= 1; changeColumn++) {
+          if (changeRow == 0 && changeColumn == 0) {
+            continue;
+          }
+          gridpoint_t* next = getPoint(row + changeRow, column + changeColumn);
+          if (next != NULL && isWalkable(next->terrain)) {
+            open |= 1 << bit;
+          }
+          bit++;
+        }
+      }
+      grid->openNeighbours[row * nColumns + column] = open;
+    }
+  }
+  grid->neighboursStale = false;
+}
+
+/**************** buildGoldDistance ****************/
+/* Rebuilds the whole distance field with one breadth-first search
+ * started from every gold pile at once. A step is one move in any of
+ * the eight directions, onto walkable terrain; other players do not
+ * block the way, since a player steps by trading places.
+ */
+static void
+buildGoldDistance(void)
+{
+  if (grid->neighboursStale) {
+    buildNeighbours();
+  }
+  const int nPoints = grid->nRows * grid->nColumns;
+  int head = 0;
+  int tail = 0;
+  for (int i = 0; i < nPoints; i++) {
+    if (grid->points[i].terrain == '*') {
+      grid->goldDistance[i] = 0;
+      grid->nearestGold[i] = i;
+      grid->frontier[tail++] = i;
+    } else {
+      grid->goldDistance[i] = -1;
+      grid->nearestGold[i] = -1;
+    }
+  }
+
+  while (head < tail) {
+    const int from = grid->frontier[head++];
+    const int distance = grid->goldDistance[from] + 1;
+    const unsigned char open = grid->openNeighbours[from];
+    for (int d = 0; d < 8; d++) {
+      const int to = from + grid->neighbourOffset[d];
+      if ((open & (1 << d)) && grid->goldDistance[to] < 0) {
+        grid->goldDistance[to] = distance;
+        grid->nearestGold[to] = grid->nearestGold[from];
+        grid->frontier[tail++] = to;
+      }
+    }
+  }
+  grid->distanceStale = false;
+}
+
+/**************** repairGoldDistance ****************/
+/* Brings the distance field up to date after the gold at the given
+ * point is picked up, touching only the points for which it was the
+ * nearest gold. invalidateDistances finds those points and gives each
+ * a starting distance from its neighbours outside that region; a
+ * breadth-first search seeded from all of them, nearest first, then
+ * settles the rest. The result is the same as rebuilding the whole
+ * field, at a cost proportional to the area the pile served.
+ */
+static void
+repairGoldDistance(gridpoint_t* gridpoint)
+{
+  const int nPoints = grid->nRows * grid->nColumns;
+  int nSeeds[3];
+  const int nInvalid = invalidateDistances(gridpoint - grid->points, nSeeds);
+
+  /* The seeds one, two, and three more than their old distance are each
+  in order of distance already, as is the queue (which only ever grows
+  by one more than the distance just settled): settling points in order
+  of distance means always taking the nearest of the four heads */
+  const int* lists[4] = { grid->seeds, grid->seeds + nPoints - nSeeds[2],
+                          grid->repairQueue + nPoints - nSeeds[0], grid->repairQueue };
+  int next[4] = { 0, nSeeds[2] - 1, nSeeds[0] - 1, 0 };
+  int end[4] = { nSeeds[1], -1, -1, 0 };
+  const int step[4] = { 1, -1, -1, 1 };   // some lists are stored backwards
+  while (true) {
+    int list = -1;
+    for (int i = 0; i < 4; i++) {
+      if (next[i] != end[i] && (list < 0
+          || grid->goldDistance[lists[i][next[i]]] < grid->goldDistance[lists[list][next[list]]])) {
+        list = i;
+      }
+    }
+    if (list < 0) {
+      break;
+    }
+    const int point = lists[list][next[list]];
+    next[list] += step[list];
+    if (!grid->repairing[point]) {
+      continue;         // settled already, from nearer
+    }
+    grid->repairing[point] = false;
+
+    const int distance = grid->goldDistance[point] + 1;
+    const unsigned char open = grid->openNeighbours[point];
+    for (int d = 0; d < 8; d++) {
+      const int neighbour = point + grid->neighbourOffset[d];
+      if ((open & (1 << d)) && grid->repairing[neighbour]
+          && (grid->goldDistance[neighbour] < 0 || distance < grid->goldDistance[neighbour])) {
+        grid->goldDistance[neighbour] = distance;
+        grid->nearestGold[neighbour] = grid->nearestGold[point];
+        grid->repairQueue[end[3]++] = neighbour;
+      }
+    }
+  }
+
+  // Whatever was never reached can reach no gold
+  for (int i = 0; i < nInvalid; i++) {
+    if (grid->repairing[grid->frontier[i]]) {
+      grid->repairing[grid->frontier[i]] = false;
+      grid->goldDistance[grid->frontier[i]] = -1;
+      grid->nearestGold[grid->frontier[i]] = -1;
+    }
+  }
+}
+
+/**************** invalidateDistances ****************/
+/* Marks as 'repairing', and lists in the frontier, every point whose
+ * nearest gold was the pile just removed at the given point. These
+ * form one connected region (each point's way to its gold runs through
+ * points with the same nearest gold), so a breadth-first search from
+ * the pile finds them, in order of their old distance. As each is
+ * taken from the frontier its distance is replaced by a starting one:
+ * one more than its nearest neighbour outside the region, or -1 if it
+ * has none. Neighbours differ by at most one step, so that is one, two,
+ * or three more than its old distance less one; the three kinds are
+ * listed, each in order of distance, at the back of the repair queue,
+ * the front of 'seeds', and the back of 'seeds', with their numbers
+ * left in nSeeds[0], [1], and [2].
+ * Returns the number of points listed in the frontier.
+ */
+static int
+invalidateDistances(const int removed, int nSeeds[3])
+{
+  const int nPoints = grid->nRows * grid->nColumns;
+  int head = 0;
+  int tail = 0;
+  grid->frontier[tail++] = removed;
+  grid->repairing[removed] = true;
+  nSeeds[0] = nSeeds[1] = nSeeds[2] = 0;
+
+  while (head < tail) {
+    const int from = grid->frontier[head++];
+    const int distance = grid->goldDistance[from];
+    const unsigned char open = grid->openNeighbours[from];
+    int best = -1;
+    for (int d = 0; d < 8; d++) {
+      const int to = from + grid->neighbourOffset[d];
+      if (!(open & (1 << d)) || grid->repairing[to]) {
+        continue;
+      }
+      if (grid->nearestGold[to] == removed) {
+        grid->repairing[to] = true;
+        grid->frontier[tail++] = to;
+      } else if (grid->goldDistance[to] >= 0 && (best < 0 || grid->goldDistance[to] + 1 < best)) {
+        best = grid->goldDistance[to] + 1;
+        grid->nearestGold[from] = grid->nearestGold[to];
+      }
+    }
+
+    grid->goldDistance[from] = best;
+    if (best == distance) {
+      grid->repairQueue[nPoints - 1 - nSeeds[0]++] = from;
+    } else if (best == distance + 1) {
+      grid->seeds[nSeeds[1]++] = from;
+    } else if (best == distance + 2) {
+      grid->seeds[nPoints - 1 - nSeeds[2]++] = from;
+    }
+  }
+  return tail;
+}
+
+/**************** recordChange ****************/
+/* Adds the gridpoint to the change log, once; if the log is full,
+ * notes that it overflowed so readers assume everything changed.
+ */
+static void
+recordChange(gridpoint_t* gridpoint)
+{
+  grid->version++;
+  if (!gridpoint->changed) {
+    if (grid->nChanges < maxChanges) {
+      grid->changes[grid->nChanges++] = gridpoint;
+      gridpoint->changed = true;
+    } else {
+      grid->overflowed = true;
+    }
+  }
+}
+
+
+/* ****************************************************************** */
+/* ************************* UNIT_TEST ****************************** */
+/* 
+ * This unit test checks the repaired distance field against a full
+ * rebuild. It picks up the gold piles of a map one at a time, in random
+ * order, and after each pickup compares the distance of every point,
+ * as repaired, with the distance a rebuild gives. It then reports the
+ * time spent on each.
+ * 
+ * Run it with a map and, optionally, a seed for the gold:
+ *   ./gridtest ../maps/big.txt 7
+ * Exit status is 0 if every distance matched, 1 otherwise.
+ */
+
+#ifdef UNIT_TEST
+
+#include "../lib/timing.h"
+
+static const int rounds = 100;
+
+int
+main(const int argc, char* argv[])
+{
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s map.txt [seed]\n", argv[0]);
+    return 2;
+  }
+  const int seed = (argc == 3) ? atoi(argv[2]) : 1;
+  mem_arena_t* arena = mem_assert(mem_arena_new(0), "arena");
+  if (gridInit(argv[1], seed, arena) == NULL) {
+    fprintf(stderr, "can't load %s\n", argv[1]);
+    mem_arena_delete(arena);
+    return 2;
+  }
+  const int nPoints = grid->nRows * grid->nColumns;
+  gridpoint_t* original = mem_malloc(nPoints * sizeof(gridpoint_t));
+  memcpy(original, grid->points, nPoints * sizeof(gridpoint_t));
+  int* repaired = mem_malloc(nPoints * sizeof(int));
+  int64_t repairTime = 0;
+  int64_t rebuildTime = 0;
+  int pickups = 0;
+  int mismatches = 0;
+
+  srand(seed);
+  for (int round = 0; round < rounds; round++) {
+    // Putting all the gold back
+    memcpy(grid->points, original, nPoints * sizeof(gridpoint_t));
+    grid->distanceStale = true;
+    gridGoldDistance(0, 0);
+
+    while (true) {
+      // Choosing one of the remaining piles
+      int nPiles = 0;
+      int pile = -1;
+      for (int i = 0; i < nPoints; i++) {
+        if (grid->points[i].terrain == '*' && rand() % ++nPiles == 0) {
+          pile = i;
+        }
+      }
+      if (pile < 0) {
+        break;
+      }
+
+      int64_t start = timing_now();
+      setPointGold(&grid->points[pile], 0);
+      setTerrain(&grid->points[pile], '.');
+      repairTime += timing_now() - start;
+      memcpy(repaired, grid->goldDistance, nPoints * sizeof(int));
+      pickups++;
+
+      start = timing_now();
+      buildGoldDistance();
+      rebuildTime += timing_now() - start;
+      for (int i = 0; i < nPoints; i++) {
+        if (repaired[i] != grid->goldDistance[i] && mismatches++ < 10) {
+          printf("pickup %d: point (%d,%d) repaired to %d, rebuilt as %d\n", pickups,
+                 i / grid->nColumns, i % grid->nColumns, repaired[i], grid->goldDistance[i]);
+        }
+      }
+    }
+    gridClearChanges();
+  }
+
+  printf("%s: %d pickups on %dx%d, %d mismatches\n", argv[1], pickups,
+         grid->nRows, grid->nColumns, mismatches);
+  if (pickups > 0) {
+    printf("repair %.2f us per pickup, rebuild %.2f us\n",
+           repairTime / 1e3 / pickups, rebuildTime / 1e3 / pickups);
+  }
+  mem_free(original);
+  mem_free(repaired);
+  gridDelete();
+  mem_arena_delete(arena);
+  return mismatches == 0 ? 0 : 1;
+}
+
+#endif // UNIT_TEST
@@ -11,6 +11,8 @@
  * Binary Brigade, Spring 2023
  */
 
+#include "../lib/mem.h"
+
 /**************** global types ****************/
 typedef struct gridpoint gridpoint_t;
 typedef struct grid grid_t;
@@ -30,19 +32,21 @@ typedef struct grid grid_t;
 *  Hereafter, it iterates through the
 *  contents of the map, saving each point
 *  in a gridpoint struct, before generating
-*  the gold. The function
-*  returns a pointer to the created grid
-*  upon successful termination. 
+*  the gold. Everything the grid holds is
+*  allocated from the given arena, which
+*  the caller deletes after gridDelete. The
+*  function returns a pointer to the created
+*  grid upon successful termination, or NULL
+*  if the map cannot be read.
  */
-grid_t* gridInit(char* pathName, int randomSeed);
+grid_t* gridInit(char* pathName, int randomSeed, mem_arena_t* arena);
 
 /**************** gridDelete ****************/
-/* The function deletes the grid.
-*  Upon checking that the grid is not NULL,
-*  it iterates through the 2D array, freeing
-*  the memory allocated in the gridInit and
-*  insertGridpoints functions and later
-*  frees the array and the grid itself.  
+/* The function deletes the grid. Its memory
+*  belongs to the arena given to gridInit, so
+*  nothing is freed one piece at a time: the
+*  grid is forgotten here, and released when
+*  the caller deletes the arena.
  */
 void gridDelete();
 
@@ -71,7 +75,9 @@ int getnColumns();
 /**************** getPoints ****************/
 /* Function is a getter for a point
 *  in the grid, making the information
-*  available to other modules. 
+*  available to other modules. Returns
+*  NULL if the row or column is outside
+*  the grid.
  */
 gridpoint_t* getPoint(int row, int column);
 
@@ -130,3 +136,63 @@ void setPointGold(gridpoint_t* gridpoint, int nGold);
 *  available to other modules. 
  */
 int getPointGold(gridpoint_t* gridpoint);
+
+/**************** gridChangeCount ****************/
+/* Function returns the number of gridpoints whose
+*  player, terrain, or gold has changed since the
+*  last call to gridClearChanges. Each point is
+*  counted once, however often it changed.
+ */
+int gridChangeCount();
+
+/**************** gridChangeAt ****************/
+/* Function returns the index'th changed gridpoint
+*  (0 <= index < gridChangeCount()), or NULL if
+*  the index is out of range.
+ */
+gridpoint_t* gridChangeAt(int index);
+
+/**************** gridChangesOverflowed ****************/
+/* Function returns true if more points changed than
+*  the change log can hold; callers should then
+*  assume that every point may have changed.
+ */
+bool gridChangesOverflowed();
+
+/**************** gridVersion ****************/
+/* Function returns a number that increases every
+*  time any gridpoint's player, terrain, or gold
+*  changes; unlike the change log, it is never
+*  reset, so a module can remember it and later
+*  tell whether anything changed since.
+ */
+unsigned long gridVersion();
+
+/**************** gridChangesSince ****************/
+/* Function returns the grid version at which the
+*  change log was last cleared. A module that last
+*  looked at version v can catch up from the change
+*  log alone if v is at least this and the log has
+*  not overflowed; otherwise it must start over.
+ */
+unsigned long gridChangesSince();
+
+/**************** gridGoldDistance ****************/
+/* Function returns the number of moves from the
+*  given point to the nearest gold pile, moving in
+*  any of the eight directions over room spots,
+*  passages, and gold; 0 on gold, and -1 if no gold
+*  can be reached or the point is off the grid.
+*  Other players are no obstacle (players trade
+*  places). The grid keeps every point's distance
+*  up to date as gold is picked up, repairing only
+*  the points that pile was nearest to, so calls
+*  are cheap however many are made.
+ */
+int gridGoldDistance(int row, int column);
+
+/**************** gridClearChanges ****************/
+/* Function empties the change log, typically once
+*  every interested client has been updated.
+ */
+void gridClearChanges();
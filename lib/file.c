@@ -6,11 +6,19 @@
  * David Kotz - 2016, 2017, 2019, 2021
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 #include <ctype.h>
+#include <sys/stat.h>
 #include "file.h"
 
+/**************** file-local constants ****************/
+enum { chunkSize = 8192 };   // bytes read at a time; an enum, since it sizes file_numLines's buffer
+
 
 /**************** file_numLines ****************/
 int
@@ -22,10 +30,13 @@ file_numLines(FILE* fp)
 
   rewind(fp);
 
+  // counting the newlines a chunk at a time
   int nlines = 0;
-  char c = '\0';
-  while ( (c = fgetc(fp)) != EOF) {
-    if (c == '\n') {
+  char chunk[chunkSize];
+  size_t nread;
+  while ( (nread = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+    const char* end = chunk + nread;
+    for (const char* p = chunk; (p = memchr(p, '\n', end - p)) != NULL; p++) {
       nlines++;
     }
   }
@@ -42,7 +53,7 @@ static int isnewline(int c) { return (c == '\n'); }
 
 /**************** file_readFile ****************/
 /* See file.h for documentation. */
-char* file_readFile(FILE* fp) { return file_readUntil(fp, never); }
+char* file_readFile(FILE* fp) { return file_readAll(fp, NULL); }
 
 /**************** file_readLine ****************/
 /* See file.h for documentation. */
@@ -75,9 +86,11 @@ file_readUntil(FILE* fp, int (*stopfunc)(int c))
   for (pos = 0; (c = fgetc(fp)) != EOF && !(*stopfunc)(c); pos++) {
     // We need to save buf[pos+1] for the terminating null
     // and buf[len-1] is the last usable slot, 
-    // so if pos+1 is past that slot, we need to grow the buffer.
+    // so if pos+1 is past that slot, we need to grow the buffer;
+    // doubling it keeps the cost of growing constant per character.
     if (pos+1 > len-1) {
-      char* newbuf = realloc(buf, ++len * sizeof(char));
+      len *= 2;
+      char* newbuf = realloc(buf, len * sizeof(char));
       if (newbuf == NULL) {
         free(buf);
         return NULL;
@@ -99,6 +112,91 @@ file_readUntil(FILE* fp, int (*stopfunc)(int c))
   }
 }
 
+/**************** file_readAll ****************/
+/* See file.h for documentation. */
+char*
+file_readAll(FILE* fp, size_t* length)
+{
+  if (fp == NULL) {
+    return NULL;
+  }
+
+  // a regular file tells us how much is left, so one buffer will do;
+  // a byte to spare, beyond the null, lets its read come up short at EOF
+  size_t len = chunkSize;
+  struct stat status;
+  long position = ftell(fp);
+  if (fstat(fileno(fp), &status) == 0 && S_ISREG(status.st_mode)
+      && position >= 0 && status.st_size >= position) {
+    len = status.st_size - position + 2;
+  }
+
+  char* buf = malloc(len);
+  if (buf == NULL) {
+    return NULL;
+  }
+
+  // reading until a short read (fread's sign of EOF or error), doubling
+  // the buffer only when a read fills it and more may be pending
+  // (which, for a regular file that does not grow meanwhile, never happens)
+  size_t pos = 0;
+  while (true) {
+    size_t wanted = len - 1 - pos;
+    size_t nread = fread(buf + pos, 1, wanted, fp);
+    pos += nread;
+    if (nread < wanted) {
+      break;
+    }
+    char* newbuf = realloc(buf, len * 2);
+    if (newbuf == NULL) {
+      free(buf);
+      return NULL;
+    }
+    buf = newbuf;
+    len *= 2;
+  }
+
+  if (pos == 0 || ferror(fp)) {
+    // nothing was read before EOF, or the read failed
+    free(buf);
+    return NULL;
+  }
+  buf[pos] = '\0';
+  if (length != NULL) {
+    *length = pos;
+  }
+  return buf;
+}
+
+/**************** file_startLines ****************/
+/* See file.h for documentation. */
+void
+file_startLines(file_lines_t* lines, const char* buffer, const size_t length)
+{
+  lines->next = buffer;
+  lines->end = buffer + length;
+}
+
+/**************** file_nextLine ****************/
+/* See file.h for documentation. */
+const char*
+file_nextLine(file_lines_t* lines, size_t* length)
+{
+  if (lines->next >= lines->end) {
+    return NULL;
+  }
+  const char* line = lines->next;
+  const char* newline = memchr(line, '\n', lines->end - line);
+  if (newline == NULL) {
+    *length = lines->end - line;
+    lines->next = lines->end;
+  } else {
+    *length = newline - line;
+    lines->next = newline + 1;
+  }
+  return line;
+}
+
 /* ********************************************************** */
 /* a simple unit test of the code above */
 #ifdef QUICKTEST
@@ -1,6 +1,10 @@
 /* 
  * file utilities - reading a word, line, or entire file
  * 
+ * For reading a whole file at once, file_readAll reads it into one
+ * buffer, and file_startLines/file_nextLine then walk the lines of
+ * that buffer in place, with no allocation per line.
+ *
  * David Kotz, 2016, 2017, 2019, 2021
  */
 
@@ -8,9 +12,20 @@
 #define __FILE_H
 
 #include <stdio.h>
+#include <stddef.h>
+
+/**************** file_lines_t ****************/
+/* Where a walk over the lines of a buffer has got to; see file_nextLine.
+ * Callers declare one (on the stack, say) and start it with
+ * file_startLines; the fields are not for them.
+ */
+typedef struct file_lines {
+  const char* next;       // start of the next line
+  const char* end;        // just past the last byte of the buffer
+} file_lines_t;
 
 /**************** file_numLines ****************/
-/* Returns the number of lines in the given file,
+/* Returns the number of lines in the given file (reading it in chunks),
  * i.e., the number of newlines in the file.
  * (If the file does not end with a newline, it will undercount by one.)
  * On return, the file pointer is back to beginning of file.
@@ -60,4 +75,35 @@ char* file_readLine(FILE* fp);
  */
 char* file_readWord(FILE* fp);
 
+/**************** file_readAll ****************/
+/* 
+ * Read the remainder of the file into one null-terminated buffer,
+ * and return a pointer to it; caller must later free() the pointer.
+ * A regular file is read in one allocation and one read; anything else
+ * (a pipe, say) in chunks, doubling the buffer as it fills.
+ * If 'length' is not NULL, the number of bytes read (not counting the
+ * terminating null) is stored there.
+ * Returns NULL if error, or if EOF reached without reading anything.
+ * After the call, file pointer is at EOF.
+ */
+char* file_readAll(FILE* fp, size_t* length);
+
+/**************** file_startLines ****************/
+/* 
+ * Start a walk over the lines of the first 'length' bytes of 'buffer'
+ * (typically from file_readAll).  The buffer is not modified, and must
+ * stay allocated for as long as the walk goes on.
+ */
+void file_startLines(file_lines_t* lines, const char* buffer, const size_t length);
+
+/**************** file_nextLine ****************/
+/* 
+ * Return a pointer to the start of the next line of the walk, and store
+ * its length, NOT counting the newline, in *length.  The line is not
+ * null-terminated: it ends where the newline is.  A last line with no
+ * newline counts as a line; an empty buffer has none.
+ * Returns NULL when there are no more lines.
+ */
+const char* file_nextLine(file_lines_t* lines, size_t* length);
+
 #endif // __FILE_H
@@ -0,0 +1,118 @@
+/* 
+ * histogram - fixed-size latency histograms
+ * 
+ * see histogram.h for more information.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "histogram.h"
+
+/**************** local constants ****************/
+static const int subBits = 5;           // 32 buckets per doubling
+static const int linear = 64;           // values below this have their own bucket
+
+/**************** local functions ****************/
+static int bucketOf(const int64_t value);
+static int64_t highestIn(const int bucket);
+
+/**************** histogram_record ****************/
+/* see histogram.h for description */
+void
+histogram_record(histogram_t* histogram, const int64_t value)
+{
+  int64_t v = value < 0 ? 0 : value;
+  histogram->buckets[bucketOf(v)]++;
+  histogram->count++;
+  histogram->total += v;
+  if (v > histogram->max) {
+    histogram->max = v;
+  }
+}
+
+/**************** histogram_percentile ****************/
+/* see histogram.h for description */
+int64_t
+histogram_percentile(const histogram_t* histogram, const double percent)
+{
+  if (histogram->count == 0) {
+    return 0;
+  }
+
+  // the rank of the value wanted, counting from 1
+  int64_t rank = (int64_t)(percent / 100 * histogram->count + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  int64_t seen = 0;
+  for (int bucket = 0; bucket < histogram_nBuckets; bucket++) {
+    seen += histogram->buckets[bucket];
+    if (seen >= rank) {
+      int64_t highest = highestIn(bucket);
+      return highest < histogram->max ? highest : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+/**************** histogram_mean ****************/
+/* see histogram.h for description */
+double
+histogram_mean(const histogram_t* histogram)
+{
+  return histogram->count == 0 ? 0 : (double)histogram->total / histogram->count;
+}
+
+/**************** histogram_merge ****************/
+/* see histogram.h for description */
+void
+histogram_merge(histogram_t* into, const histogram_t* from)
+{
+  for (int bucket = 0; bucket < histogram_nBuckets; bucket++) {
+    into->buckets[bucket] += from->buckets[bucket];
+  }
+  into->count += from->count;
+  into->total += from->total;
+  if (from->max > into->max) {
+    into->max = from->max;
+  }
+}
+
+/**************** histogram_reset ****************/
+/* see histogram.h for description */
+void
+histogram_reset(histogram_t* histogram)
+{
+  memset(histogram, 0, sizeof(histogram_t));
+}
+
+/**************** bucketOf ****************/
+/* Return the bucket that counts the (non-negative) value.
+ */
+static int
+bucketOf(const int64_t value)
+{
+  if (value < linear) {
+    return value;
+  }
+  int magnitude = 63 - __builtin_clzll(value);     // 2^magnitude <= value
+  int bucket = linear + (magnitude - (subBits + 1)) * (1 << subBits)
+               + (int)(value >> (magnitude - subBits)) - (1 << subBits);
+  return bucket < histogram_nBuckets ? bucket : histogram_nBuckets - 1;
+}
+
+/**************** highestIn ****************/
+/* Return the largest value counted by the bucket.
+ */
+static int64_t
+highestIn(const int bucket)
+{
+  if (bucket < linear) {
+    return bucket;
+  }
+  int magnitude = (bucket - linear) / (1 << subBits) + subBits + 1;
+  int64_t sub = (bucket - linear) % (1 << subBits) + (1 << subBits);
+  return ((sub + 1) << (magnitude - subBits)) - 1;
+}
@@ -0,0 +1,57 @@
+/* 
+ * histogram - fixed-size latency histograms, in the style of HDR Histogram
+ * 
+ * A histogram counts nanosecond values in log-linear buckets: values
+ * below 64 each get a bucket of their own, and every doubling above that
+ * is split into 32 equal buckets, so any value is known to within about
+ * 3%. Values of 2^36 ns (about 69 seconds) or more land in the last
+ * bucket. A histogram is one fixed-size struct with no pointers: it can
+ * be declared static, or embedded in another struct, and recording a
+ * value never allocates.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <stdint.h>
+
+/**************** global types ****************/
+enum { histogram_nBuckets = 64 + 30 * 32 };
+
+typedef struct histogram {
+  int64_t count;
+  int64_t total;
+  int64_t max;
+  uint32_t buckets[histogram_nBuckets];
+} histogram_t;
+
+/**************** histogram_record ****************/
+/* Count one value, in nanoseconds; negative values count as 0.
+ */
+void histogram_record(histogram_t* histogram, const int64_t value);
+
+/**************** histogram_percentile ****************/
+/* Return the value below which 'percent' (0 to 100) percent of the
+ * recorded values fall, to within the bucket's precision; never more
+ * than the largest value recorded. Return 0 if nothing was recorded.
+ */
+int64_t histogram_percentile(const histogram_t* histogram, const double percent);
+
+/**************** histogram_mean ****************/
+/* Return the mean of the recorded values, or 0 if there are none.
+ */
+double histogram_mean(const histogram_t* histogram);
+
+/**************** histogram_merge ****************/
+/* Add every value counted in 'from' to 'into'.
+ */
+void histogram_merge(histogram_t* into, const histogram_t* from);
+
+/**************** histogram_reset ****************/
+/* Forget every recorded value.
+ */
+void histogram_reset(histogram_t* histogram);
+
+#endif // __HISTOGRAM_H
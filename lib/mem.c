@@ -8,19 +8,83 @@
  * 2. Variants that 'assert' the result is non-NULL;
  *    if NULL occurs, kick out an error and die.
  *
+ * 3. Arenas, which hand out space from large blocks and free it
+ *    all at once.
+ *
+ * 4. Counts per subsystem, and markers around code that must not
+ *    allocate.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
 #include "mem.h"
 
+/**************** file-local constants ****************/
+static const size_t defaultBlockSize = 64 * 1024;
+static const size_t alignment = _Alignof(max_align_t);
+
+/**************** file-local types ****************/
+// every block from malloc starts with a header, so mem_free knows what it frees
+typedef union header {
+  struct {
+    size_t size;                  // bytes asked for
+    mem_subsystem_t subsystem;    // who asked
+  } info;
+  max_align_t align;              // keeps what follows aligned for any type
+} header_t;
+
+typedef struct counts {
+  int nmalloc;
+  int nfree;
+  size_t held;                    // bytes allocated and not yet freed
+  size_t peak;                    // the most ever held at once
+  int narena;                     // allocations from arenas
+  size_t arenaBytes;              // bytes they asked for
+} counts_t;
+
+typedef struct arenaBlock {
+  struct arenaBlock* next;  // the block allocated before this one
+  size_t size;              // bytes available in data
+  size_t used;              // bytes handed out from data
+  max_align_t data[];       // the space itself, aligned for any type
+} arenaBlock_t;
+
+struct mem_arena {
+  mem_subsystem_t subsystem;  // whose blocks these are
+  arenaBlock_t* blocks;     // newest first
+  arenaBlock_t* first;      // the block made with the arena, kept by reset
+  size_t blockSize;
+  int nalloc;               // allocations since creation or reset
+  size_t requested;         // bytes they asked for
+  int nblocks;              // blocks held
+  size_t reserved;          // bytes in those blocks
+};
+
+static void* allocate(mem_subsystem_t subsystem, const size_t size, const bool zero,
+                      const char* message);
+static arenaBlock_t* newBlock(mem_arena_t* arena, const size_t size);
+
 /**************** file-local global variables ****************/
 // track malloc and free across *all* calls within this program.
 static int nmalloc = 0;         // number of successful malloc calls
 static int nfree = 0;           // number of free calls
 static int nfreenull = 0;       // number of free(NULL) calls
 
+// and per subsystem
+static counts_t counts[mem_nSubsystems];
+static const char* subsystemNames[mem_nSubsystems] = {
+  "other", "grid", "player", "game", "message", "render"
+};
+
+// the code that must not allocate, if it is running
+static const char* noallocLabel = NULL;
+static int violations = 0;
+
 
 /**************** mem_assert ****************/
 /* see mem.h for description */
@@ -49,14 +113,14 @@ mem_assert_const(const void* ptr, const char* message)
 /**************** mem_malloc_assert() ****************/
 /* see mem.h for description */
 void*
-mem_malloc_assert(const size_t size, const char* message)
+mem_malloc_assert_for(const mem_subsystem_t subsystem, const size_t size,
+                      const char* message)
 {
-  void* ptr = malloc(size);
+  void* ptr = allocate(subsystem, size, false, message);
   if (ptr == NULL) {
     fprintf(stderr, "Out of memory: %s\n", message);
     exit (99);
   }
-  nmalloc++;
   return ptr;
 }
 
@@ -64,35 +128,29 @@ mem_malloc_assert(const size_t size, const char* message)
 /**************** mem_malloc() ****************/
 /* see mem.h for description */
 void*
-mem_malloc(const size_t size)
+mem_malloc_for(const mem_subsystem_t subsystem, const size_t size)
 {
-  void* ptr = malloc(size);
-  if (ptr != NULL) {
-    nmalloc++;
-  }
-  return ptr;
+  return allocate(subsystem, size, false, NULL);
 }
 
 /**************** mem_calloc_assert() ****************/
 /* see mem.h for description */
 void*
-mem_calloc_assert(const size_t nmemb, const size_t size, const char* message)
+mem_calloc_assert_for(const mem_subsystem_t subsystem, const size_t nmemb,
+                      const size_t size, const char* message)
 {
-  void* ptr = mem_assert(calloc(nmemb, size), message);
-  nmalloc++;
-  return ptr;
+  return mem_assert(mem_calloc_for(subsystem, nmemb, size), message);
 }
 
 /**************** mem_calloc() ****************/
 /* see mem.h for description */
 void*
-mem_calloc(const size_t nmemb, const size_t size)
+mem_calloc_for(const mem_subsystem_t subsystem, const size_t nmemb, const size_t size)
 {
-  void* ptr = calloc(nmemb, size);
-  if (ptr != NULL) {
-    nmalloc++;
+  if (size != 0 && nmemb > (size_t)-1 / size) {
+    return NULL;
   }
-  return ptr;
+  return allocate(subsystem, nmemb * size, true, NULL);
 }
 
 /**************** mem_free() ****************/
@@ -101,7 +159,11 @@ void
 mem_free(void* ptr)
 {
   if (ptr != NULL) {
-    free(ptr);
+    header_t* header = (header_t*)ptr - 1;
+    counts_t* count = &counts[header->info.subsystem];
+    count->nfree++;
+    count->held -= header->info.size;
+    free(header);
     nfree++;
   } else {
     // it's an error to call free(NULL)!
@@ -125,3 +187,272 @@ mem_net(void)
 {
   return nmalloc - nfree - nfreenull;
 }
+
+/**************** mem_allocs() ****************/
+/* see mem.h for description */
+int
+mem_allocs(void)
+{
+  return nmalloc;
+}
+
+/**************** mem_held() ****************/
+/* see mem.h for description */
+size_t
+mem_held(void)
+{
+  size_t held = 0;
+  for (int s = 0; s < mem_nSubsystems; s++) {
+    held += counts[s].held;
+  }
+  return held;
+}
+
+/**************** mem_report_subsystems() ****************/
+/* see mem.h for description */
+void
+mem_report_subsystems(FILE* fp, const char* message)
+{
+  fprintf(fp, "%s:\n", message);
+  for (int s = 0; s < mem_nSubsystems; s++) {
+    counts_t* count = &counts[s];
+    if (count->nmalloc > 0 || count->narena > 0) {
+      fprintf(fp, "  %-8s %d malloc, %d free, %zu bytes held, %zu peak; "
+              "%d arena alloc, %zu bytes\n", subsystemNames[s], count->nmalloc,
+              count->nfree, count->held, count->peak, count->narena, count->arenaBytes);
+    }
+  }
+}
+
+/**************** mem_noalloc_begin() ****************/
+/* see mem.h for description */
+void
+mem_noalloc_begin(const char* label)
+{
+  noallocLabel = label;
+  violations = 0;
+}
+
+/**************** mem_noalloc_end() ****************/
+/* see mem.h for description */
+int
+mem_noalloc_end(void)
+{
+  noallocLabel = NULL;
+  return violations;
+}
+
+/**************** mem_arena_new() ****************/
+/* see mem.h for description */
+mem_arena_t*
+mem_arena_new_for(const mem_subsystem_t subsystem, const size_t blockSize)
+{
+  mem_arena_t* arena = mem_malloc_for(subsystem, sizeof(mem_arena_t));
+  if (arena == NULL) {
+    return NULL;
+  }
+  arena->subsystem = subsystem;
+  arena->blocks = NULL;
+  arena->blockSize = (blockSize > 0) ? blockSize : defaultBlockSize;
+  arena->nalloc = 0;
+  arena->requested = 0;
+  arena->nblocks = 0;
+  arena->reserved = 0;
+
+  // the first block is made now, and kept across resets
+  arena->first = newBlock(arena, arena->blockSize);
+  if (arena->first == NULL) {
+    mem_free(arena);
+    return NULL;
+  }
+  arena->blocks = arena->first;
+  return arena;
+}
+
+/**************** mem_arena_alloc() ****************/
+/* see mem.h for description */
+void*
+mem_arena_alloc_for(const mem_subsystem_t subsystem, mem_arena_t* arena, const size_t size)
+{
+  if (arena == NULL) {
+    return NULL;
+  }
+  const size_t rounded = (size + alignment - 1) / alignment * alignment;
+  arenaBlock_t* block = arena->blocks;
+
+  if (rounded > arena->blockSize / 2) {
+    // a large allocation gets a block of its own, placed behind the
+    // current block so that the rest of the current block stays in use
+    arenaBlock_t* own = newBlock(arena, rounded);
+    if (own == NULL) {
+      return NULL;
+    }
+    own->next = block->next;
+    block->next = own;
+    block = own;
+  } else if (block->used + rounded > block->size) {
+    block = newBlock(arena, arena->blockSize);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+
+  void* ptr = (char*)block->data + block->used;
+  block->used += rounded;
+  arena->nalloc++;
+  arena->requested += size;
+  counts[subsystem].narena++;
+  counts[subsystem].arenaBytes += size;
+  return ptr;
+}
+
+/**************** mem_arena_alloc_assert() ****************/
+/* see mem.h for description */
+void*
+mem_arena_alloc_assert_for(const mem_subsystem_t subsystem, mem_arena_t* arena,
+                           const size_t size, const char* message)
+{
+  void* ptr = mem_arena_alloc_for(subsystem, arena, size);
+  if (ptr == NULL) {
+    fprintf(stderr, "Out of memory: %s\n", message);
+    exit (99);
+  }
+  return ptr;
+}
+
+/**************** mem_arena_calloc() ****************/
+/* see mem.h for description */
+void*
+mem_arena_calloc_for(const mem_subsystem_t subsystem, mem_arena_t* arena,
+                     const size_t nmemb, const size_t size)
+{
+  if (size != 0 && nmemb > (size_t)-1 / size) {
+    return NULL;
+  }
+  void* ptr = mem_arena_alloc_for(subsystem, arena, nmemb * size);
+  if (ptr != NULL) {
+    memset(ptr, 0, nmemb * size);
+  }
+  return ptr;
+}
+
+/**************** mem_arena_calloc_assert() ****************/
+/* see mem.h for description */
+void*
+mem_arena_calloc_assert_for(const mem_subsystem_t subsystem, mem_arena_t* arena,
+                            const size_t nmemb, const size_t size, const char* message)
+{
+  return mem_assert(mem_arena_calloc_for(subsystem, arena, nmemb, size), message);
+}
+
+/**************** mem_arena_reset() ****************/
+/* see mem.h for description */
+void
+mem_arena_reset(mem_arena_t* arena)
+{
+  if (arena == NULL) {
+    return;
+  }
+  while (arena->blocks != NULL) {
+    arenaBlock_t* block = arena->blocks;
+    arena->blocks = block->next;
+    if (block != arena->first) {
+      arena->nblocks--;
+      arena->reserved -= block->size;
+      mem_free(block);
+    }
+  }
+  arena->first->next = NULL;
+  arena->first->used = 0;
+  arena->blocks = arena->first;
+  arena->nalloc = 0;
+  arena->requested = 0;
+}
+
+/**************** mem_arena_delete() ****************/
+/* see mem.h for description */
+void
+mem_arena_delete(mem_arena_t* arena)
+{
+  if (arena != NULL) {
+    while (arena->blocks != NULL) {
+      arenaBlock_t* block = arena->blocks;
+      arena->blocks = block->next;
+      mem_free(block);
+    }
+    mem_free(arena);
+  }
+}
+
+/**************** mem_arena_report() ****************/
+/* see mem.h for description */
+void
+mem_arena_report(FILE* fp, const char* message, mem_arena_t* arena)
+{
+  if (arena == NULL) {
+    fprintf(fp, "%s: no arena\n", message);
+    return;
+  }
+  fprintf(fp, "%s: %d alloc, %zu bytes requested, %d blocks, %zu bytes reserved\n",
+          message, arena->nalloc, arena->requested, arena->nblocks, arena->reserved);
+}
+
+/**************** newBlock ****************/
+/* Allocate a block with room for 'size' bytes, and count it in the
+ * arena; the caller links it in.
+ */
+static arenaBlock_t*
+newBlock(mem_arena_t* arena, const size_t size)
+{
+  arenaBlock_t* block = allocate(arena->subsystem, sizeof(arenaBlock_t) + size, false,
+                                 "arena block");
+  if (block != NULL) {
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    arena->nblocks++;
+    arena->reserved += size;
+  }
+  return block;
+}
+
+/**************** allocate ****************/
+/* Allocate 'size' bytes, zeroed if asked, behind a header recording the
+ * size and the subsystem, and count them; report the allocation if it
+ * comes where none should.
+ */
+static void*
+allocate(mem_subsystem_t subsystem, const size_t size, const bool zero,
+         const char* message)
+{
+  if (size > (size_t)-1 - sizeof(header_t)) {
+    return NULL;
+  }
+  header_t* header = zero ? calloc(1, sizeof(header_t) + size)
+                          : malloc(sizeof(header_t) + size);
+  if (header == NULL) {
+    return NULL;
+  }
+  if (subsystem < 0 || subsystem >= mem_nSubsystems) {
+    subsystem = mem_other;
+  }
+  header->info.size = size;
+  header->info.subsystem = subsystem;
+
+  nmalloc++;
+  counts_t* count = &counts[subsystem];
+  count->nmalloc++;
+  count->held += size;
+  if (count->held > count->peak) {
+    count->peak = count->held;
+  }
+
+  if (noallocLabel != NULL) {
+    violations++;
+    fprintf(stderr, "ALLOCATION during %s: %zu bytes for %s (%s)\n", noallocLabel,
+            size, subsystemNames[subsystem], message != NULL ? message : "no message");
+  }
+  return header + 1;
+}
@@ -14,6 +14,17 @@
  *    that needs to defensively check function parameters that
  *    "should never be NULL".
  *
+ * 4. Arenas, for many objects that live and die together: each
+ *    allocation bumps a pointer within a large block, nothing is
+ *    freed one object at a time, and the whole arena is reset or
+ *    deleted at once.  Blocks come from mem_malloc, so they show up
+ *    in mem_report like any other allocation.
+ *
+ * 5. Counts per subsystem (grid, player, ...): allocations, frees,
+ *    bytes held and the most ever held, and arena allocations; and
+ *    markers between which any allocation is reported as an error,
+ *    so that tests can hold hot paths to making none.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
@@ -22,6 +33,25 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+
+/**************** mem_subsystem_t ****************/
+/* Every allocation is counted against the subsystem that made it.
+ * A source file names its subsystem by defining MEM_SUBSYSTEM before
+ * it includes anything that includes this file:
+ *   #define MEM_SUBSYSTEM mem_grid
+ * Files that do not are counted as mem_other.  The allocation functions
+ * below are macros that pass MEM_SUBSYSTEM to the functions behind
+ * them (mem_malloc to mem_malloc_for, and so on).
+ */
+typedef enum {
+  mem_other, mem_grid, mem_player, mem_game, mem_message, mem_render,
+  mem_nSubsystems
+} mem_subsystem_t;
+
+#ifndef MEM_SUBSYSTEM
+#define MEM_SUBSYSTEM mem_other
+#endif
 
 /**************** mem_assert **************************/
 /* If pointer p is NULL, print error message to stderr and die,
@@ -50,7 +80,10 @@ const void* mem_assert_const(const void* p, const char* message);
  *   the pointer produced by malloc.
  * We exit if any error, after printing to stderr.
  */
-void* mem_malloc_assert(const size_t size, const char* message);
+#define mem_malloc_assert(size, message) \
+  mem_malloc_assert_for(MEM_SUBSYSTEM, (size), (message))
+void* mem_malloc_assert_for(const mem_subsystem_t subsystem, const size_t size,
+                            const char* message);
 
 /**************** mem_malloc() ****************/
 /* Just like malloc() but track the number of successful allocations
@@ -60,7 +93,8 @@ void* mem_malloc_assert(const size_t size, const char* message);
  *   pointer to allocated space, or NULL if failure.
  * We track the number of calls - see mem_net().
  */
-void* mem_malloc(const size_t size);
+#define mem_malloc(size) mem_malloc_for(MEM_SUBSYSTEM, (size))
+void* mem_malloc_for(const mem_subsystem_t subsystem, const size_t size);
 
 /**************** mem_calloc_assert() ****************/
 /* Just like calloc() but track the number of successful allocations
@@ -72,8 +106,10 @@ void* mem_malloc(const size_t size);
  *   the pointer produced by calloc.
  * We exit if any error, after printing to stderr.
  */
-void* mem_calloc_assert(const size_t nmemb, const size_t size, 
-                          const char* message);
+#define mem_calloc_assert(nmemb, size, message) \
+  mem_calloc_assert_for(MEM_SUBSYSTEM, (nmemb), (size), (message))
+void* mem_calloc_assert_for(const mem_subsystem_t subsystem, const size_t nmemb,
+                            const size_t size, const char* message);
 
 /**************** mem_calloc() ****************/
 /* Just like calloc() but track the number of successful allocations.
@@ -83,12 +119,16 @@ void* mem_calloc_assert(const size_t nmemb, const size_t size,
  *   pointer to allocated space, or NULL if failure.
  * We track the number of calls - see mem_net().
  */
-void* mem_calloc(const size_t nmemb, const size_t size);
+#define mem_calloc(nmemb, size) mem_calloc_for(MEM_SUBSYSTEM, (nmemb), (size))
+void* mem_calloc_for(const mem_subsystem_t subsystem, const size_t nmemb,
+                     const size_t size);
 
 /**************** mem_free() ****************/
-/* Just like free() but track the number of calls.
+/* Just like free() but track the number of calls, and the bytes freed,
+ * against the subsystem that allocated them.
  * We assume:
- *   caller provides pointer to space produced by mem_malloc or mem_calloc.
+ *   caller provides pointer to space produced by mem_malloc or mem_calloc
+ *   (and never passes such a pointer to free() or realloc()).
  * We track the number of calls - see mem_net().
  */
 void mem_free(void* ptr);
@@ -113,4 +153,120 @@ void mem_report(FILE* fp, const char* message);
  */
 int mem_net(void);
 
+/**************** mem_allocs() ****************/
+/* Return the number of successful allocations so far, freed or not;
+ * comparing two readings tells whether the code between them allocated.
+ */
+int mem_allocs(void);
+
+/**************** mem_held() ****************/
+/* Return the bytes now held, over all subsystems, by allocations from
+ * mem_malloc and mem_calloc (arena blocks included).
+ */
+size_t mem_held(void);
+
+/**************** mem_report_subsystems() ****************/
+/* Print, for each subsystem that allocated anything, its counts of
+ * allocations and frees, the bytes it holds now and the most it ever
+ * held at once, and its allocations from arenas.
+ * We assume:
+ *   caller provides a FILE open for writing, and message suitable for printf.
+ */
+void mem_report_subsystems(FILE* fp, const char* message);
+
+/**************** mem_noalloc_begin() ****************/
+/* Mark the start of code that must not allocate: until the matching
+ * mem_noalloc_end, every allocation from the heap (including a new arena
+ * block, but not space handed out from an existing one) is a violation,
+ * reported to stderr with its subsystem, size, and message, and the
+ * given label.
+ * We assume:
+ *   caller provides a label string, which stays valid until the end mark.
+ */
+void mem_noalloc_begin(const char* label);
+
+/**************** mem_noalloc_end() ****************/
+/* Mark the end of code begun with mem_noalloc_begin.
+ * We return:
+ *   the number of violations since the matching begin mark.
+ */
+int mem_noalloc_end(void);
+
+/**************** mem_arena_t ****************/
+typedef struct mem_arena mem_arena_t;  // opaque to users of the module
+
+/**************** mem_arena_new() ****************/
+/* Create an empty arena that grows in blocks of (at least) blockSize
+ * bytes; 0 means a default size.
+ * We return:
+ *   pointer to the new arena, or NULL if out of memory.
+ * Caller is responsible for calling mem_arena_delete later.
+ */
+#define mem_arena_new(blockSize) mem_arena_new_for(MEM_SUBSYSTEM, (blockSize))
+mem_arena_t* mem_arena_new_for(const mem_subsystem_t subsystem, const size_t blockSize);
+
+/**************** mem_arena_alloc() ****************/
+/* Like mem_malloc(), but the space comes from the arena, aligned for
+ * any type.  It is not to be passed to mem_free(); it lasts until the
+ * arena is reset or deleted.  An allocation larger than half a block
+ * gets a block of its own.  The blocks are counted against the subsystem
+ * that made the arena, the allocation against the one that asked for it.
+ * We return:
+ *   pointer to allocated space, or NULL if failure.
+ */
+#define mem_arena_alloc(arena, size) mem_arena_alloc_for(MEM_SUBSYSTEM, (arena), (size))
+void* mem_arena_alloc_for(const mem_subsystem_t subsystem, mem_arena_t* arena,
+                          const size_t size);
+
+/**************** mem_arena_alloc_assert() ****************/
+/* Like mem_arena_alloc(), but if out of memory, print error and die.
+ * We assume:
+ *   caller provides a message string suitable for printf.
+ */
+#define mem_arena_alloc_assert(arena, size, message) \
+  mem_arena_alloc_assert_for(MEM_SUBSYSTEM, (arena), (size), (message))
+void* mem_arena_alloc_assert_for(const mem_subsystem_t subsystem, mem_arena_t* arena,
+                                 const size_t size, const char* message);
+
+/**************** mem_arena_calloc() ****************/
+/* Like mem_calloc(), but the space comes from the arena; see
+ * mem_arena_alloc().
+ */
+#define mem_arena_calloc(arena, nmemb, size) \
+  mem_arena_calloc_for(MEM_SUBSYSTEM, (arena), (nmemb), (size))
+void* mem_arena_calloc_for(const mem_subsystem_t subsystem, mem_arena_t* arena,
+                           const size_t nmemb, const size_t size);
+
+/**************** mem_arena_calloc_assert() ****************/
+/* Like mem_arena_calloc(), but if out of memory, print error and die.
+ * We assume:
+ *   caller provides a message string suitable for printf.
+ */
+#define mem_arena_calloc_assert(arena, nmemb, size, message) \
+  mem_arena_calloc_assert_for(MEM_SUBSYSTEM, (arena), (nmemb), (size), (message))
+void* mem_arena_calloc_assert_for(const mem_subsystem_t subsystem, mem_arena_t* arena,
+                                  const size_t nmemb, const size_t size,
+                                  const char* message);
+
+/**************** mem_arena_reset() ****************/
+/* Release everything allocated from the arena, all at once, keeping
+ * its first block for reuse; the arena may then be used again.
+ */
+void mem_arena_reset(mem_arena_t* arena);
+
+/**************** mem_arena_delete() ****************/
+/* Release the arena and everything allocated from it.
+ * NULL is ignored.
+ */
+void mem_arena_delete(mem_arena_t* arena);
+
+/**************** mem_arena_report() ****************/
+/* Print a report of the arena's use, in the manner of mem_report():
+ * the number of allocations and the bytes they asked for since the
+ * arena was created or last reset, and the blocks and bytes it holds.
+ * We assume:
+ *   caller provides a FILE open for writing, and message suitable for printf.
+ */
+void mem_arena_report(FILE* fp, const char* message, mem_arena_t* arena);
+
 #endif // __MEM_H
@@ -0,0 +1,152 @@
+/* 
+ * scratch - short-lived memory, and messages built in it
+ * 
+ * See scratch.h for documentation.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+// allocations here are counted against the message subsystem (see mem.h)
+#define MEM_SUBSYSTEM mem_message
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "scratch.h"
+#include "mem.h"
+
+/**************** file-local constants ****************/
+static const size_t blockSize = 16 * 1024;    // enough for any one event's messages
+static const size_t minCapacity = 64;         // bytes first given to a message
+
+/**************** file-local types ****************/
+struct scratch_msg {
+  char* text;
+  size_t length;      // not counting the terminating null
+  size_t capacity;    // bytes available at text
+};
+
+/**************** file-local global variables ****************/
+static mem_arena_t* scratch = NULL;   // made at first use
+
+/**************** file-local functions ****************/
+static void appendf(scratch_msg_t* msg, const char* format, va_list args);
+
+/**************** scratch_alloc ****************/
+/* see scratch.h for description */
+void*
+scratch_alloc(const size_t size)
+{
+  if (scratch == NULL) {
+    scratch = mem_assert(mem_arena_new(blockSize), "scratch");
+  }
+  return mem_arena_alloc_assert(scratch, size, "scratch");
+}
+
+/**************** scratch_printf ****************/
+/* see scratch.h for description */
+char*
+scratch_printf(const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  char* text = scratch_alloc(length + 1);
+  va_start(args, format);
+  vsnprintf(text, length + 1, format, args);
+  va_end(args);
+  return text;
+}
+
+/**************** scratch_msg ****************/
+/* see scratch.h for description */
+scratch_msg_t*
+scratch_msg(const char* format, ...)
+{
+  scratch_msg_t* msg = scratch_alloc(sizeof(scratch_msg_t));
+  msg->text = scratch_alloc(minCapacity);
+  msg->text[0] = '\0';
+  msg->length = 0;
+  msg->capacity = minCapacity;
+
+  va_list args;
+  va_start(args, format);
+  appendf(msg, format, args);
+  va_end(args);
+  return msg;
+}
+
+/**************** scratch_append ****************/
+/* see scratch.h for description */
+void
+scratch_append(scratch_msg_t* msg, const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  appendf(msg, format, args);
+  va_end(args);
+}
+
+/**************** scratch_text ****************/
+/* see scratch.h for description */
+const char*
+scratch_text(const scratch_msg_t* msg)
+{
+  return msg->text;
+}
+
+/**************** scratch_reset ****************/
+/* see scratch.h for description */
+void
+scratch_reset(void)
+{
+  mem_arena_reset(scratch);
+}
+
+/**************** scratch_report ****************/
+/* see scratch.h for description */
+void
+scratch_report(FILE* fp, const char* message)
+{
+  mem_arena_report(fp, message, scratch);
+}
+
+/**************** scratch_done ****************/
+/* see scratch.h for description */
+void
+scratch_done(void)
+{
+  mem_arena_delete(scratch);
+  scratch = NULL;
+}
+
+/**************** appendf ****************/
+/* Format onto the end of the message; if it does not fit, move the
+ * message to scratch space twice as large (or as large as needed) and
+ * format again. The old space is simply left until the next reset.
+ */
+static void
+appendf(scratch_msg_t* msg, const char* format, va_list args)
+{
+  va_list again;
+  va_copy(again, args);
+  size_t room = msg->capacity - msg->length;
+  size_t length = vsnprintf(msg->text + msg->length, room, format, args);
+
+  if (length >= room) {
+    size_t capacity = 2 * msg->capacity;
+    if (capacity < msg->length + length + 1) {
+      capacity = msg->length + length + 1;
+    }
+    char* text = scratch_alloc(capacity);
+    memcpy(text, msg->text, msg->length);
+    vsnprintf(text + msg->length, capacity - msg->length, format, again);
+    msg->text = text;
+    msg->capacity = capacity;
+  }
+  msg->length += length;
+  va_end(again);
+}
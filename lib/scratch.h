@@ -0,0 +1,67 @@
+/* 
+ * scratch - short-lived memory, and messages built in it
+ * 
+ * Scratch memory lasts only while one event is handled: the server
+ * resets it after every handler run, all at once, so whatever is built
+ * there (typically an outbound message, which the outbox copies) needs
+ * no freeing, and after the first few events no heap allocation at all.
+ * It is an arena (see mem.h) shared by the whole program.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#ifndef __SCRATCH_H
+#define __SCRATCH_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**************** global types ****************/
+typedef struct scratch_msg scratch_msg_t;  // opaque to users of the module
+
+/**************** scratch_alloc ****************/
+/* Return 'size' bytes of scratch memory, aligned for any type, valid
+ * until the next scratch_reset.  Dies if out of memory.
+ */
+void* scratch_alloc(const size_t size);
+
+/**************** scratch_printf ****************/
+/* Format a string, as sprintf would, into scratch memory.
+ * We return:
+ *   the string, valid until the next scratch_reset.
+ */
+char* scratch_printf(const char* format, ...);
+
+/**************** scratch_msg ****************/
+/* Start building a message, with text formatted as by printf; the
+ * message and its text live in scratch memory.
+ */
+scratch_msg_t* scratch_msg(const char* format, ...);
+
+/**************** scratch_append ****************/
+/* Append text, formatted as by printf, to the message, growing it as
+ * needed.
+ */
+void scratch_append(scratch_msg_t* msg, const char* format, ...);
+
+/**************** scratch_text ****************/
+/* Return the text of the message, valid until the next scratch_reset.
+ */
+const char* scratch_text(const scratch_msg_t* msg);
+
+/**************** scratch_reset ****************/
+/* Release all scratch memory at once; pointers into it become invalid.
+ */
+void scratch_reset(void);
+
+/**************** scratch_report ****************/
+/* Print a report of scratch memory in use, as mem_arena_report does.
+ */
+void scratch_report(FILE* fp, const char* message);
+
+/**************** scratch_done ****************/
+/* Free scratch memory for good (e.g., at exit).
+ */
+void scratch_done(void);
+
+#endif // __SCRATCH_H
@@ -0,0 +1,31 @@
+/* 
+ * timing - a monotonic clock for pacing, timers, and measurements
+ * 
+ * See timing.h for documentation.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <time.h>
+#include "timing.h"
+
+/**************** timing_now ****************/
+/* see timing.h for description */
+int64_t
+timing_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**************** timing_seconds ****************/
+/* see timing.h for description */
+double
+timing_seconds(const int64_t nanoseconds)
+{
+  return nanoseconds / 1e9;
+}
@@ -0,0 +1,25 @@
+/* 
+ * timing - a monotonic clock for pacing, timers, and measurements
+ * 
+ * All times are nanoseconds on a monotonic clock whose origin is
+ * unspecified; only differences between two readings are meaningful.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#ifndef __TIMING_H
+#define __TIMING_H
+
+#include <stdint.h>
+
+/**************** timing_now ****************/
+/* Return the current monotonic time, in nanoseconds.
+ */
+int64_t timing_now(void);
+
+/**************** timing_seconds ****************/
+/* Convert a nanosecond interval to (fractional) seconds.
+ */
+double timing_seconds(const int64_t nanoseconds);
+
+#endif // __TIMING_H
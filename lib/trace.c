@@ -0,0 +1,132 @@
+/* 
+ * trace - spans of time, written out for a trace viewer
+ * 
+ * See trace.h for documentation.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "trace.h"
+#include "timing.h"
+#include "mem.h"
+
+/**************** file-local constants ****************/
+static const size_t defaultSpans = 1 << 20;
+
+/**************** file-local types ****************/
+typedef struct span {
+  const char* name;
+  int64_t start;
+  int64_t end;
+} span_t;
+
+/**************** file-local global variables ****************/
+static struct {
+  bool on;
+  const char* path;
+  span_t* spans;
+  size_t nSpans;
+  size_t maxSpans;
+  size_t dropped;
+  int64_t origin;     // time of trace_open; spans are written relative to it
+} trace;
+
+/**************** trace_open ****************/
+/* see trace.h for description */
+bool
+trace_open(const char* path, const size_t maxSpans)
+{
+  if (trace.on || path == NULL) {
+    return false;
+  }
+  trace.maxSpans = (maxSpans > 0) ? maxSpans : defaultSpans;
+  trace.spans = mem_malloc(trace.maxSpans * sizeof(span_t));
+  if (trace.spans == NULL) {
+    return false;
+  }
+  trace.path = path;
+  trace.nSpans = 0;
+  trace.dropped = 0;
+  trace.origin = timing_now();
+  trace.on = true;
+  return true;
+}
+
+/**************** trace_now ****************/
+/* see trace.h for description */
+int64_t
+trace_now(void)
+{
+  return trace.on ? timing_now() : 0;
+}
+
+/**************** trace_span ****************/
+/* see trace.h for description */
+void
+trace_span(const char* name, const int64_t start)
+{
+  if (!trace.on) {
+    return;
+  }
+  if (trace.nSpans == trace.maxSpans) {
+    trace.dropped++;
+    return;
+  }
+  span_t* span = &trace.spans[trace.nSpans++];
+  span->name = name;
+  span->start = start;
+  span->end = timing_now();
+}
+
+/**************** trace_write ****************/
+/* see trace.h for description */
+bool
+trace_write(void)
+{
+  if (!trace.on) {
+    return false;
+  }
+  FILE* fp = fopen(trace.path, "w");
+  if (fp == NULL) {
+    return false;
+  }
+
+  // complete ("X") events, with times in microseconds
+  fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for (size_t i = 0; i < trace.nSpans; i++) {
+    const span_t* span = &trace.spans[i];
+    fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+            "\"ts\":%.3f,\"dur\":%.3f}%s\n", span->name,
+            (span->start - trace.origin) / 1e3, (span->end - span->start) / 1e3,
+            i + 1 < trace.nSpans ? "," : "");
+  }
+  fprintf(fp, "]}\n");
+  return fclose(fp) == 0;
+}
+
+/**************** trace_dropped ****************/
+/* see trace.h for description */
+size_t
+trace_dropped(void)
+{
+  return trace.dropped;
+}
+
+/**************** trace_close ****************/
+/* see trace.h for description */
+bool
+trace_close(void)
+{
+  if (!trace.on) {
+    return true;
+  }
+  bool written = trace_write();
+  mem_free(trace.spans);
+  trace.spans = NULL;
+  trace.on = false;
+  return written;
+}
@@ -0,0 +1,67 @@
+/* 
+ * trace - spans of time, written out for a trace viewer
+ * 
+ * While tracing is on, the program records spans: a name (a string
+ * that must outlive the trace, typically a literal) and the time it
+ * began and ended. Spans are kept in a buffer allocated once, at
+ * trace_open, so recording one costs two clock readings and a store;
+ * when the buffer is full, further spans are counted and dropped.
+ * trace_write writes every span recorded so far as Chrome trace-event
+ * JSON, which chrome://tracing and Perfetto open; spans that nest in
+ * time are shown nested.
+ *
+ * A typical span:
+ *   int64_t start = trace_now();
+ *   ...
+ *   trace_span("gridDisplay", start);
+ * While tracing is off, trace_now and trace_span return at once.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**************** trace_open ****************/
+/* Start tracing, into a buffer of 'maxSpans' spans (0 means 1M, about
+ * 24 MB), to be written to the file at 'path'.
+ * We return:
+ *   true on success; false if out of memory, or already tracing.
+ * Caller is responsible for calling trace_close later.
+ */
+bool trace_open(const char* path, const size_t maxSpans);
+
+/**************** trace_now ****************/
+/* Return the time a span starts, in nanoseconds (see timing.h); 0 if
+ * tracing is off.
+ */
+int64_t trace_now(void);
+
+/**************** trace_span ****************/
+/* Record a span with the given name, from 'start' (from trace_now)
+ * until now. Does nothing if tracing is off.
+ */
+void trace_span(const char* name, const int64_t start);
+
+/**************** trace_write ****************/
+/* (Re)write the trace file with every span recorded so far; tracing
+ * goes on. Return false if the file cannot be written.
+ */
+bool trace_write(void);
+
+/**************** trace_dropped ****************/
+/* Return the number of spans dropped because the buffer was full.
+ */
+size_t trace_dropped(void);
+
+/**************** trace_close ****************/
+/* Write the trace file, then stop tracing and free the buffer.
+ * Return false if the file cannot be written.
+ */
+bool trace_close(void);
+
+#endif // __TRACE_H
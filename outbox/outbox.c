@@ -0,0 +1,593 @@
+/*
+ * outbox.c - Nuggets 'outbox' module
+ *
+ * see outbox.h for more information.
+ *
+ * Binary Brigade, Spring 2023
+ */
+
+// allocations here are counted against the message subsystem (see mem.h)
+#define MEM_SUBSYSTEM mem_message
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include "outbox.h"
+#include "../support/message.h"
+#include "../lib/mem.h"
+#include "../lib/timing.h"
+#include "../stats/stats.h"
+#include "../lib/trace.h"
+
+/**************** local constants ****************/
+static const int maxPending = 32;       // messages queued per client
+static const int initialClients = 32;   // queues allocated at first use
+static const int slotCapacity = 64;     // bytes each slot starts with; most messages fit
+
+/**************** local types ****************/
+typedef struct outmsg {
+  char* text;         // message text; capacity is kept when slot is reused
+  int length;
+  int capacity;
+  const char* live;   // if not NULL, the caller's buffer, sent instead of text
+  bool display;       // a DISPLAY, which a newer DISPLAY may replace
+} outmsg_t;
+
+typedef struct outqueue {
+  addr_t address;
+  bool inUse;         // false while the queue waits on the free list
+  int nextFree;       // next queue on the free list, or -1
+  int busyAt;         // position in the busy list, or -1 if empty
+  outmsg_t* slots;    // ring buffer of maxPending messages
+  int head;
+  int count;
+  double tokens;      // bytes that may still be sent; may go negative
+  int64_t refilled;   // time at which tokens were last topped up
+  int64_t rtt;        // round-trip time last reported by the client, ns
+  int64_t maxRtt;     // the largest reported so far
+  char* display;      // copy of the pending DISPLAY, if it was queued by copy;
+  int displayCapacity;  //   at most one is pending, so one buffer will do
+} outqueue_t;
+
+typedef struct outbox {
+  int rate;           // bytes per second per client; 0 means unlimited
+  outqueue_t* queues;
+  int nQueues;        // queues ever set up, in use or free
+  int maxQueues;
+  int freeQueue;      // first queue of the free list, or -1
+  int* busy;          // numbers of the queues holding messages
+  int nBusy;
+  int* index;         // hash table of queue numbers, -1 where empty
+  int indexSize;      // twice maxQueues, a power of two
+  int dropped;
+} outbox_t;
+
+/**************** global variables ****************/
+static outbox_t* outbox = NULL;
+
+/**************** local functions ****************/
+static void enqueue(const addr_t to, const char* message, const bool live);
+static outqueue_t* findQueue(const addr_t address, const bool create);
+static void indexQueues(void);
+static void unindexQueue(const int number);
+static void markBusy(outqueue_t* queue);
+static void markIdle(outqueue_t* queue);
+static void dropSlot(outqueue_t* queue, const int position);
+static void setSlot(outmsg_t* slot, const char* message, const int length);
+static void setLive(outmsg_t* slot, const char* message);
+static void setDisplay(outqueue_t* queue, outmsg_t* slot, const char* message, const int length);
+static void refill(outqueue_t* queue, const int64_t now);
+static void flushQueue(outqueue_t* queue, const bool force);
+static void sendNow(const addr_t to, const char* message, const int length);
+
+/**************** outbox_init ****************/
+/* see outbox.h for description */
+void
+outbox_init(const int bytesPerSecond)
+{
+  outbox = mem_malloc_assert(sizeof(outbox_t), "outbox");
+  outbox->rate = bytesPerSecond > 0 ? bytesPerSecond : 0;
+  outbox->queues = mem_calloc_assert(initialClients, sizeof(outqueue_t), "outbox queues");
+  outbox->nQueues = 0;
+  outbox->maxQueues = initialClients;
+  outbox->freeQueue = -1;
+  outbox->busy = mem_malloc_assert(initialClients * sizeof(int), "outbox busy list");
+  outbox->nBusy = 0;
+  outbox->index = NULL;
+  indexQueues();
+  outbox->dropped = 0;
+}
+
+/**************** outbox_send ****************/
+/* see outbox.h for description */
+void
+outbox_send(const addr_t to, const char* message)
+{
+  enqueue(to, message, false);
+}
+
+/**************** outbox_sendLive ****************/
+/* see outbox.h for description */
+void
+outbox_sendLive(const addr_t to, const char* message)
+{
+  enqueue(to, message, true);
+}
+
+/**************** outbox_reply ****************/
+/* see outbox.h for description */
+void
+outbox_reply(const addr_t to, const char* message)
+{
+  if (outbox == NULL || message == NULL || !message_isAddr(to)) {
+    return;
+  }
+  if (findQueue(to, false) != NULL) {
+    enqueue(to, message, false);
+  } else {
+    sendNow(to, message, strlen(message));
+  }
+}
+
+/**************** outbox_forget ****************/
+/* see outbox.h for description */
+void
+outbox_forget(const addr_t client)
+{
+  if (outbox == NULL || !message_isAddr(client)) {
+    return;
+  }
+  outqueue_t* queue = findQueue(client, false);
+  if (queue == NULL) {
+    return;
+  }
+  flushQueue(queue, true);
+
+  // the queue keeps its slot buffers, ready for the next new client
+  const int number = queue - outbox->queues;
+  unindexQueue(number);
+  queue->inUse = false;
+  queue->nextFree = outbox->freeQueue;
+  outbox->freeQueue = number;
+}
+
+/**************** outbox_flush ****************/
+/* see outbox.h for description */
+void
+outbox_flush(void)
+{
+  if (outbox != NULL) {
+    // backwards, since a queue that empties leaves the list in place of the last
+    for (int i = outbox->nBusy - 1; i >= 0; i--) {
+      flushQueue(&outbox->queues[outbox->busy[i]], false);
+    }
+  }
+}
+
+/**************** outbox_drain ****************/
+/* see outbox.h for description */
+void
+outbox_drain(void)
+{
+  if (outbox != NULL) {
+    for (int i = outbox->nBusy - 1; i >= 0; i--) {
+      flushQueue(&outbox->queues[outbox->busy[i]], true);
+    }
+  }
+}
+
+/**************** outbox_pending ****************/
+/* see outbox.h for description */
+bool
+outbox_pending(void)
+{
+  return outbox != NULL && outbox->nBusy > 0;
+}
+
+/**************** outbox_dropped ****************/
+/* see outbox.h for description */
+int
+outbox_dropped(void)
+{
+  return outbox != NULL ? outbox->dropped : 0;
+}
+
+/**************** outbox_noteRtt ****************/
+/* see outbox.h for description */
+void
+outbox_noteRtt(const addr_t client, const int64_t rtt)
+{
+  if (outbox == NULL || !message_isAddr(client) || rtt <= 0) {
+    return;
+  }
+  outqueue_t* queue = findQueue(client, false);
+  if (queue == NULL) {
+    return;
+  }
+  queue->rtt = rtt;
+  if (rtt > queue->maxRtt) {
+    queue->maxRtt = rtt;
+  }
+}
+
+/**************** outbox_rtt ****************/
+/* see outbox.h for description */
+int64_t
+outbox_rtt(const addr_t client, int64_t* maxRtt)
+{
+  outqueue_t* queue = NULL;
+  if (outbox != NULL && message_isAddr(client)) {
+    queue = findQueue(client, false);
+  }
+  if (maxRtt != NULL) {
+    *maxRtt = queue != NULL ? queue->maxRtt : 0;
+  }
+  return queue != NULL ? queue->rtt : 0;
+}
+
+/**************** outbox_done ****************/
+/* see outbox.h for description */
+void
+outbox_done(void)
+{
+  if (outbox != NULL) {
+    outbox_drain();
+
+    // Freeing the text held by every slot of every queue
+    for (int i = 0; i < outbox->nQueues; i++) {
+      outqueue_t* queue = &outbox->queues[i];
+      for (int s = 0; s < maxPending; s++) {
+        if (queue->slots[s].text != NULL) {
+          mem_free(queue->slots[s].text);
+        }
+      }
+      mem_free(queue->slots);
+      if (queue->display != NULL) {
+        mem_free(queue->display);
+      }
+    }
+    mem_free(outbox->queues);
+    mem_free(outbox->busy);
+    mem_free(outbox->index);
+    mem_free(outbox);
+    outbox = NULL;
+  }
+}
+
+/**************** enqueue ****************/
+/* Queue the message for the given address, as a copy or, if 'live',
+ * as a reference to the caller's buffer; see outbox_send.
+ */
+static void
+enqueue(const addr_t to, const char* message, const bool live)
+{
+  if (outbox == NULL || message == NULL || !message_isAddr(to)) {
+    return;
+  }
+  outqueue_t* queue = findQueue(to, true);
+  const int length = strlen(message);
+
+  // QUIT goes out now, after whatever was queued ahead of it
+  if (strncmp(message, "QUIT", strlen("QUIT")) == 0) {
+    flushQueue(queue, true);
+    sendNow(to, message, length);
+    queue->tokens -= length;
+    return;
+  }
+
+  // Only the newest DISPLAY for a client is worth sending; it goes at
+  // the end, so it never overtakes messages queued after the old frame
+  const bool display = (strncmp(message, "DISPLAY", strlen("DISPLAY")) == 0);
+  if (display) {
+    for (int i = 0; i < queue->count; i++) {
+      if (queue->slots[(queue->head + i) % maxPending].display) {
+        dropSlot(queue, i);
+        break;
+      }
+    }
+  }
+
+  // Backpressure: a client that is this far behind loses the message
+  if (queue->count == maxPending) {
+    outbox->dropped++;
+    return;
+  }
+  outmsg_t* slot = &queue->slots[(queue->head + queue->count) % maxPending];
+  slot->display = display;
+  queue->count++;
+  markBusy(queue);
+
+  if (live) {
+    setLive(slot, message);
+  } else if (display) {
+    setDisplay(queue, slot, message, length);
+  } else {
+    setSlot(slot, message, length);
+  }
+}
+
+/**************** findQueue ****************/
+/* Return the queue for the given address. If there is none, return
+ * NULL or, with 'create', set one up (with a full budget), reusing a
+ * queue freed by outbox_forget if there is one.
+ */
+static outqueue_t*
+findQueue(const addr_t address, const bool create)
+{
+  const int mask = outbox->indexSize - 1;
+  int bucket = message_hashAddr(address) & mask;
+  while (outbox->index[bucket] >= 0) {
+    outqueue_t* queue = &outbox->queues[outbox->index[bucket]];
+    if (message_eqAddr(address, queue->address)) {
+      return queue;
+    }
+    bucket = (bucket + 1) & mask;
+  }
+  if (!create) {
+    return NULL;
+  }
+
+  int number;
+  if (outbox->freeQueue >= 0) {
+    number = outbox->freeQueue;
+    outbox->freeQueue = outbox->queues[number].nextFree;
+  } else {
+    // Growing the array of queues if needed
+    if (outbox->nQueues == outbox->maxQueues) {
+      int maxQueues = outbox->maxQueues * 2;
+      outqueue_t* queues = mem_calloc_assert(maxQueues, sizeof(outqueue_t), "outbox queues");
+      memcpy(queues, outbox->queues, outbox->nQueues * sizeof(outqueue_t));
+      mem_free(outbox->queues);
+      outbox->queues = queues;
+      int* busy = mem_malloc_assert(maxQueues * sizeof(int), "outbox busy list");
+      memcpy(busy, outbox->busy, outbox->nBusy * sizeof(int));
+      mem_free(outbox->busy);
+      outbox->busy = busy;
+      outbox->maxQueues = maxQueues;
+      indexQueues();
+      bucket = message_hashAddr(address) & (outbox->indexSize - 1);
+      while (outbox->index[bucket] >= 0) {
+        bucket = (bucket + 1) & (outbox->indexSize - 1);
+      }
+    }
+    number = outbox->nQueues++;
+    outqueue_t* queue = &outbox->queues[number];
+    queue->slots = mem_calloc_assert(maxPending, sizeof(outmsg_t), "outbox slots");
+
+    // every slot gets its buffer now, so that short messages never allocate
+    for (int s = 0; s < maxPending; s++) {
+      queue->slots[s].text = mem_malloc_assert(slotCapacity, "outbox message");
+      queue->slots[s].capacity = slotCapacity;
+    }
+    queue->display = NULL;
+    queue->displayCapacity = 0;
+  }
+
+  outbox->index[bucket] = number;
+  outqueue_t* queue = &outbox->queues[number];
+  queue->address = address;
+  queue->inUse = true;
+  queue->nextFree = -1;
+  queue->busyAt = -1;
+  queue->head = 0;
+  queue->count = 0;
+  queue->tokens = outbox->rate;
+  queue->refilled = timing_now();
+  queue->rtt = 0;
+  queue->maxRtt = 0;
+  return queue;
+}
+
+/**************** indexQueues ****************/
+/* (Re)build the hash table over the queues in use, sized for maxQueues,
+ * so that a client's queue is found without scanning every queue.
+ */
+static void
+indexQueues(void)
+{
+  if (outbox->index != NULL) {
+    mem_free(outbox->index);
+  }
+  outbox->indexSize = 2 * outbox->maxQueues;
+  outbox->index = mem_malloc_assert(outbox->indexSize * sizeof(int), "outbox index");
+  for (int i = 0; i < outbox->indexSize; i++) {
+    outbox->index[i] = -1;
+  }
+
+  const int mask = outbox->indexSize - 1;
+  for (int i = 0; i < outbox->nQueues; i++) {
+    if (!outbox->queues[i].inUse) {
+      continue;
+    }
+    int bucket = message_hashAddr(outbox->queues[i].address) & mask;
+    while (outbox->index[bucket] >= 0) {
+      bucket = (bucket + 1) & mask;
+    }
+    outbox->index[bucket] = i;
+  }
+}
+
+/**************** unindexQueue ****************/
+/* Remove the given queue from the hash table, shifting back any later
+ * entries of its probe run that would otherwise no longer be found.
+ */
+static void
+unindexQueue(const int number)
+{
+  const int mask = outbox->indexSize - 1;
+  int hole = message_hashAddr(outbox->queues[number].address) & mask;
+  while (outbox->index[hole] != number) {
+    hole = (hole + 1) & mask;
+  }
+
+  for (int next = (hole + 1) & mask; outbox->index[next] >= 0; next = (next + 1) & mask) {
+    int home = message_hashAddr(outbox->queues[outbox->index[next]].address) & mask;
+    // the entry stays put if its home lies cyclically in (hole, next]
+    bool stays = hole <= next ? (hole < home && home <= next)
+                              : (hole < home || home <= next);
+    if (!stays) {
+      outbox->index[hole] = outbox->index[next];
+      hole = next;
+    }
+  }
+  outbox->index[hole] = -1;
+}
+
+/**************** markBusy ****************/
+/* Put the queue on the busy list, if it is not already there.
+ */
+static void
+markBusy(outqueue_t* queue)
+{
+  if (queue->busyAt < 0) {
+    queue->busyAt = outbox->nBusy;
+    outbox->busy[outbox->nBusy++] = queue - outbox->queues;
+  }
+}
+
+/**************** markIdle ****************/
+/* Take the queue off the busy list, moving the last entry into its place.
+ */
+static void
+markIdle(outqueue_t* queue)
+{
+  if (queue->busyAt >= 0) {
+    const int last = outbox->busy[--outbox->nBusy];
+    outbox->busy[queue->busyAt] = last;
+    outbox->queues[last].busyAt = queue->busyAt;
+    queue->busyAt = -1;
+  }
+}
+
+/**************** dropSlot ****************/
+/* Remove the message at the given position in the queue, moving those
+ * behind it up one; the dropped slot, buffer and all, goes to the end.
+ */
+static void
+dropSlot(outqueue_t* queue, const int position)
+{
+  outmsg_t dropped = queue->slots[(queue->head + position) % maxPending];
+  for (int i = position; i < queue->count - 1; i++) {
+    queue->slots[(queue->head + i) % maxPending] = queue->slots[(queue->head + i + 1) % maxPending];
+  }
+  queue->slots[(queue->head + queue->count - 1) % maxPending] = dropped;
+  queue->count--;
+}
+
+/**************** setSlot ****************/
+/* Copy the message into the slot, growing the slot's buffer if needed.
+ */
+static void
+setSlot(outmsg_t* slot, const char* message, const int length)
+{
+  if (slot->capacity < length + 1) {
+    int capacity = slot->capacity > 0 ? slot->capacity : slotCapacity;
+    while (capacity < length + 1) {
+      capacity *= 2;
+    }
+    if (slot->text != NULL) {
+      mem_free(slot->text);
+    }
+    slot->text = mem_malloc_assert(capacity, "outbox message");
+    slot->capacity = capacity;
+  }
+  memcpy(slot->text, message, length + 1);
+  slot->length = length;
+  slot->live = NULL;
+}
+
+/**************** setLive ****************/
+/* Point the slot at the caller's buffer instead of a copy; the slot's
+ * own buffer, if any, is kept for later reuse.
+ */
+static void
+setLive(outmsg_t* slot, const char* message)
+{
+  slot->live = message;
+  slot->length = 0;
+}
+
+/**************** setDisplay ****************/
+/* Copy a DISPLAY into the queue's own display buffer, growing it if
+ * needed, and point the slot at it. Frames are far larger than other
+ * messages, and come in every slot in turn; kept in one buffer, they
+ * stop allocating once the buffer has grown to the client's frame size.
+ */
+static void
+setDisplay(outqueue_t* queue, outmsg_t* slot, const char* message, const int length)
+{
+  if (queue->displayCapacity < length + 1) {
+    if (queue->display != NULL) {
+      mem_free(queue->display);
+    }
+    queue->display = mem_malloc_assert(length + 1, "outbox display");
+    queue->displayCapacity = length + 1;
+  }
+  memcpy(queue->display, message, length + 1);
+  setLive(slot, queue->display);
+}
+
+/**************** refill ****************/
+/* Top up the queue's tokens for the time elapsed since the last refill,
+ * allowing at most one second's worth of burst.
+ */
+static void
+refill(outqueue_t* queue, const int64_t now)
+{
+  queue->tokens += outbox->rate * timing_seconds(now - queue->refilled);
+  if (queue->tokens > outbox->rate) {
+    queue->tokens = outbox->rate;
+  }
+  queue->refilled = now;
+}
+
+/**************** flushQueue ****************/
+/* Send queued messages in order while the budget is not exhausted;
+ * with 'force', send all of them. A message is sent whenever the budget
+ * is non-negative, so frames larger than one second's budget still go
+ * out, and the debt delays whatever follows.
+ */
+static void
+flushQueue(outqueue_t* queue, const bool force)
+{
+  if (queue->count == 0) {
+    return;
+  }
+  if (outbox->rate > 0) {
+    refill(queue, timing_now());
+  }
+
+  while (queue->count > 0 && (force || outbox->rate == 0 || queue->tokens >= 0)) {
+    outmsg_t* slot = &queue->slots[queue->head];
+    if (slot->live != NULL) {
+      // a live buffer is sent as it reads now, and may have changed length
+      const int length = strlen(slot->live);
+      sendNow(queue->address, slot->live, length);
+      queue->tokens -= length;
+      slot->live = NULL;
+    } else {
+      sendNow(queue->address, slot->text, slot->length);
+      queue->tokens -= slot->length;
+    }
+    queue->head = (queue->head + 1) % maxPending;
+    queue->count--;
+  }
+  if (queue->count == 0) {
+    markIdle(queue);
+  }
+}
+
+/**************** sendNow ****************/
+/* Send the message, of the given length, timing the send for the
+ * server's stats and trace.
+ */
+static void
+sendNow(const addr_t to, const char* message, const int length)
+{
+  int64_t start = timing_now();
+  message_send(to, message);
+  stats_sent(message, length, timing_now() - start);
+  trace_span("message_send", start);
+}
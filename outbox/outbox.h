@@ -0,0 +1,107 @@
+/*
+ * outbox.h - header file for Nuggets outbox module
+ *
+ * The outbox sits between the game and the message module. Instead of
+ * writing every message straight to the socket, the server queues it
+ * here, per client, and the event loop flushes the queues. Each client
+ * has a byte-rate budget (a token bucket); a client that cannot keep up
+ * does not receive frames it could never render, because a newly queued
+ * DISPLAY replaces any DISPLAY still pending for that client. Messages
+ * beginning with QUIT are never delayed or dropped.
+ *
+ * Binary Brigade, Spring 2023
+ */
+
+#ifndef _OUTBOX_H_
+#define _OUTBOX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../support/message.h"
+
+/**************** outbox_init ****************/
+/* Initialize the outbox.
+ * Caller provides:
+ *   the budget for each client, in bytes per second; 0 means unlimited.
+ * Caller is responsible for calling outbox_done later.
+ */
+void outbox_init(const int bytesPerSecond);
+
+/**************** outbox_send ****************/
+/* Queue a copy of the message for the given address.
+ * A DISPLAY drops any DISPLAY already pending for that address and
+ * joins the end of the queue, behind messages queued after the old one;
+ * a QUIT first drains that address's queue, then goes out immediately.
+ * If the queue is full, the message is dropped and counted.
+ */
+void outbox_send(const addr_t to, const char* message);
+
+/**************** outbox_sendLive ****************/
+/* Like outbox_send, but queue a reference to the message rather than
+ * a copy: when the message is finally sent, the buffer goes out as it
+ * reads at that moment. This lets one frame, rendered once, be queued
+ * for any number of clients at no cost per client beyond the send, and
+ * a client who falls behind gets the newest frame when it catches up.
+ * Caller provides:
+ *   a buffer that stays allocated, and holds a complete message
+ *   whenever the outbox might flush, until outbox_done.
+ */
+void outbox_sendLive(const addr_t to, const char* message);
+
+/**************** outbox_reply ****************/
+/* Send a one-off reply (PONG, ERROR, STATS, a refusal). If the address
+ * is a client with a queue, the reply is queued behind that client's
+ * messages, as by outbox_send; otherwise it goes out now, and no queue
+ * is made for the address.
+ */
+void outbox_reply(const addr_t to, const char* message);
+
+/**************** outbox_forget ****************/
+/* Send whatever is still queued for the client, then release its queue
+ * for reuse by the next new client. Meant to be called when a player or
+ * spectator leaves; does nothing if the address has no queue.
+ */
+void outbox_forget(const addr_t client);
+
+/**************** outbox_flush ****************/
+/* Send as many queued messages as each client's budget allows.
+ * Meant to be called from the event loop, after each handler runs
+ * and on every timeout.
+ */
+void outbox_flush(void);
+
+/**************** outbox_drain ****************/
+/* Send every queued message, ignoring budgets (e.g., at game over).
+ */
+void outbox_drain(void);
+
+/**************** outbox_pending ****************/
+/* Return true if any message is waiting to be sent.
+ */
+bool outbox_pending(void);
+
+/**************** outbox_dropped ****************/
+/* Return the number of messages dropped, over all clients, because
+ * a queue was full.
+ */
+int outbox_dropped(void);
+
+/**************** outbox_noteRtt ****************/
+/* Record the round-trip time, in nanoseconds, that a client reports
+ * measuring (see PING in the server); non-positive times are ignored.
+ */
+void outbox_noteRtt(const addr_t client, const int64_t rtt);
+
+/**************** outbox_rtt ****************/
+/* Return the round-trip time the client last reported, in nanoseconds,
+ * or 0 if it never did; if 'maxRtt' is not NULL, also store there the
+ * largest it reported.
+ */
+int64_t outbox_rtt(const addr_t client, int64_t* maxRtt);
+
+/**************** outbox_done ****************/
+/* Drain the queues and free all memory held by the outbox.
+ */
+void outbox_done(void);
+
+#endif // _OUTBOX_H_
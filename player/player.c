@@ -6,10 +6,14 @@
  * Binary Brigade, Spring 2023
  */
 
+// allocations here are counted against the player subsystem (see mem.h)
+#define MEM_SUBSYSTEM mem_player
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <math.h>
 #include <ctype.h>
 #include "player.h"
@@ -19,37 +23,55 @@
 
 /**************** local functions ****************/
 static bool lineCheck(const int pr, const int pc, const int row, const int col);
-static bool** initializeBooleanArray(const int numRows, const int numCols);
+static bool* initializeBooleanArray(const int numRows, const int numCols);
+static void freeFog(player_t* player);
 
 /**************** global constants ****************/
 const int maxNameLength = 50;
+enum { maxQueuedKeys = 16 };    // an enum, since it sizes the key queue
+
+/**************** global variables ****************/
+// Keystrokes queued so far, over all players, stamping each with its
+// place in the order of arrival. At most maxPlayers*maxQueuedKeys are
+// pending at once, so 16 bits compare safely across wrap-around.
+static uint16_t keyArrivals = 0;
 
 /**************** global types ****************/
+/* The fields read on every move and every frame come first, together,
+ * so they share a cache line; the name, read only for the summary, is
+ * kept apart at its own length. The fog planes are allocated when the
+ * player is first shown the map (never, for a bot) and freed as soon
+ * as the player leaves.
+ */
 typedef struct player {
-  char* port;
-  addr_t address;
-  char name[50];
-  char letter;
   int x_coord;
   int y_coord;
+  int visibleX;         // position for which 'visible' was last computed
+  int visibleY;
   int num_gold;
+  char letter;
   bool active;
-  int numRows;
-  int numCols;
-  bool** known;
-  bool** visible;
+  unsigned char keyHead;
+  unsigned char keyCount;
+  char keys[maxQueuedKeys];  // keystrokes waiting for the next tick (ring buffer)
+  bool* known;          // getnRows()*getnColumns(), row by row; NULL until needed
+  bool* visible;
+  addr_t address;
+  uint16_t arrived[maxQueuedKeys];  // each key's stamp from keyArrivals; read only at ticks
+  char* name;
 } player_t;
 
 
 /**************** player_new ****************/
 /* see player.h for description */
 player_t*
-player_new(addr_t address, char* name, int x, int y, char letter)
+player_new(addr_t address, char* name, int x, int y, char letter, mem_arena_t* arena)
 {
-  player_t* player = mem_malloc(sizeof(player_t));
-  const int rows = getnRows();
-  const int cols = getnColumns();
+  player_t* player = mem_arena_alloc(arena, sizeof(player_t));
   int nameLength = strlen(name);
+  if (nameLength > maxNameLength) {
+    nameLength = maxNameLength;
+  }
   
   if (player == NULL) {
     return NULL;
@@ -62,25 +84,29 @@ player_new(addr_t address, char* name, int x, int y, char letter)
     player->num_gold = 0;
     player->active = true;
     player->letter = letter;
-    player->numRows = rows;
-    player->numCols = cols;
-    player->known = initializeBooleanArray(rows, cols);
-    player->visible = initializeBooleanArray(rows, cols); 
-
-    if (nameLength > maxNameLength) {
-      name[maxNameLength] = '\0';
-      nameLength = maxNameLength;
+    player->keyHead = 0;
+    player->keyCount = 0;
+    player->visibleX = -1;
+    player->visibleY = -1;
+    player->known = NULL;
+    player->visible = NULL;
+
+    // keep a copy of the name, truncated, at just the length needed
+    player->name = mem_arena_alloc(arena, nameLength + 1);
+    if (player->name == NULL) {
+      return NULL;
     }
+    memcpy(player->name, name, nameLength);
+    player->name[nameLength] = '\0';
     
     // replace invalid characters with underscores
     for (int i = 0; i < nameLength; i++) {
       
-      if (!isgraph(name[i]) && !isblank(name[i])) {
-        name[i] = '_';
+      if (!isgraph(player->name[i]) && !isblank(player->name[i])) {
+        player->name[i] = '_';
       }
     }
 
-    strcpy(player->name, name);
     return player;
   }
 }
@@ -97,6 +123,7 @@ player_inactive(player_t* player)
     setPlayer(point, '0');
 
     player->active = false;
+    freeFog(player);
   }
 }
 
@@ -107,17 +134,7 @@ void
 player_delete(player_t* player)
 {
   if (player != NULL) {
-    for (int i = 0; i < player->numRows; i++) {
-      if (player->known[i] != NULL){
-        mem_free(player->known[i]);
-      }
-      if (player->known[i] != NULL){
-        mem_free(player->visible[i]);
-      }
-  }
-  free(player->known);
-  free(player->visible);
-  free(player);
+    freeFog(player);
   }
 }
 
@@ -254,12 +271,65 @@ isActive(player_t* player)
   return false;
 }
 
+/**************** isBot ****************/
+/* see player.h for description */
+bool
+isBot(player_t* player)
+{
+  return player != NULL && !message_isAddr(player->address);
+}
+
+/**************** player_queueKey ****************/
+/* see player.h for description */
+bool
+player_queueKey(player_t* player, char key)
+{
+  if (player == NULL || player->keyCount == maxQueuedKeys) {
+    return false;
+  }
+  const int tail = (player->keyHead + player->keyCount) % maxQueuedKeys;
+  player->keys[tail] = key;
+  player->arrived[tail] = keyArrivals++;
+  player->keyCount++;
+  return true;
+}
+
+/**************** player_keyBefore ****************/
+/* see player.h for description */
+bool
+player_keyBefore(player_t* player, player_t* other)
+{
+  if (player == NULL || player->keyCount == 0) {
+    return false;
+  }
+  if (other == NULL || other->keyCount == 0) {
+    return true;
+  }
+  uint16_t mine = player->arrived[player->keyHead];
+  uint16_t theirs = other->arrived[other->keyHead];
+  return (int16_t)(mine - theirs) < 0;
+}
+
+/**************** player_nextKey ****************/
+/* see player.h for description */
+char
+player_nextKey(player_t* player)
+{
+  if (player == NULL || player->keyCount == 0) {
+    return '\0';
+  }
+  char key = player->keys[player->keyHead];
+  player->keyHead = (player->keyHead + 1) % maxQueuedKeys;
+  player->keyCount--;
+  return key;
+}
+
 /**************** isVisible ****************/
 /* see player.h for description */
 bool
 isVisible(player_t* player, const int row, const int col)
 {
-  if (player->visible[row][col]) {
+  if (player->visible != NULL && player->visible[row * getnColumns() + col]) {
     return true;
   }
   else {
@@ -273,7 +343,7 @@ isVisible(player_t* player, const int row, const int col)
 bool
 isKnown(player_t* player, const int row, const int col)
 {
-  if (player->known[row][col]) {
+  if (player->known != NULL && player->known[row * getnColumns() + col]) {
     return true;
   }
   else {
@@ -282,22 +352,78 @@ isKnown(player_t* player, const int row, const int col)
 }
 
 
+/**************** get_known ****************/
+/* see player.h for description */
+const bool*
+get_known(player_t* player)
+{
+  return player != NULL ? player->known : NULL;
+}
+
+/**************** get_visible ****************/
+/* see player.h for description */
+const bool*
+get_visible(player_t* player)
+{
+  return player != NULL ? player->visible : NULL;
+}
+
+/**************** player_memory ****************/
+/* see player.h for description */
+size_t
+player_memory(player_t* player, size_t* fog)
+{
+  size_t fogBytes = 0;
+  if (player == NULL) {
+    return 0;
+  }
+  if (player->known != NULL) {
+    fogBytes = 2 * (size_t)getnRows() * getnColumns() * sizeof(bool);
+  }
+  if (fog != NULL) {
+    *fog = fogBytes;
+  }
+  return sizeof(player_t) + strlen(player->name) + 1 + fogBytes;
+}
+
 /**************** updateVisibility ****************/
 /* see player.h for description */
 void
 updateVisibility(player_t* player)
 {
-  for (int row = 0; row < player->numRows; row++) {
-    for (int col = 0; col < player->numCols; col++) {
+  if (!player->active) {
+    return;
+  }
+  const int numRows = getnRows();
+  const int numCols = getnColumns();
+
+  // the fog planes are needed from the first time the player is shown the map
+  if (player->known == NULL) {
+    player->known = initializeBooleanArray(numRows, numCols);
+    player->visible = initializeBooleanArray(numRows, numCols);
+    player->visibleX = -1;
+    player->visibleY = -1;
+  }
+
+  // Only open spots ever change, so nothing changes unless the player moved
+  if (player->visibleX == player->x_coord && player->visibleY == player->y_coord) {
+    return;
+  }
+  player->visibleX = player->x_coord;
+  player->visibleY = player->y_coord;
+
+  for (int row = 0; row < numRows; row++) {
+    for (int col = 0; col < numCols; col++) {
       
       // point visible, make it known
+      const int index = row * numCols + col;
       if (lineCheck(player->y_coord, player->x_coord, row, col)) {
-        player->visible[row][col] = true;
-        player->known[row][col] = true;
+        player->visible[index] = true;
+        player->known[index] = true;
       
       } else {
         // point not visible, but can remain known
-        player->visible[row][col] = false;
+        player->visible[index] = false;
       }
     }
   }
@@ -305,29 +431,27 @@ updateVisibility(player_t* player)
 
 
 /**************** initializeBooleanArray ****************/
-/* Allocate a 2D array of booleans, initialized to false. */
-static bool**
+/* Allocate a 2D array of booleans, stored contiguously row by row,
+ * initialized to false. */
+static bool*
 initializeBooleanArray(const int numRows, const int numCols)
 {
-  bool** array = mem_malloc(numRows * sizeof(bool*));
-  if (array == NULL) {
-    // Error handling if memory allocation fails
-    return NULL;
+  return mem_calloc_assert(numRows * numCols, sizeof(bool), "fog");
+}
+
+/**************** freeFog ****************/
+/* Free the player's known and visible planes, if any. */
+static void
+freeFog(player_t* player)
+{
+  if (player->known != NULL) {
+    mem_free(player->known);
+    player->known = NULL;
   }
-  for (int i = 0; i < numRows; i++) {
-    array[i] = mem_malloc(numCols * sizeof(bool));
-    
-    if (array[i] == NULL) {
-      // Error handling if memory allocation fails
-      return NULL;
-    }
-    
-    for (int j = 0; j < numCols; j++) {
-      array[i][j] = false;
-    }
+  if (player->visible != NULL) {
+    mem_free(player->visible);
+    player->visible = NULL;
   }
-
-  return array;
 }
 
 
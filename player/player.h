@@ -5,6 +5,7 @@
  */
 
 #include "../support/message.h"
+#include "../lib/mem.h"
 
 // /**************** global types ****************/
 typedef struct player player_t;
@@ -12,15 +13,18 @@ typedef struct player player_t;
 /**************** FUNCTION ****************/
 
 
-/* Create a new player structure w/ given parameters
+/* Create a new player structure w/ given parameters, allocated
+ * (with its name) from the match's arena
  *
  * We return:
  *   pointer to a new playeryer; NULL if error (out of memory).
  */
-player_t* player_new(addr_t address, char* name, int x, int y, char letter);
+player_t* player_new(addr_t address, char* name, int x, int y, char letter,
+                     mem_arena_t* arena);
 
 
-/* Take in a pointer to a player and makes it inactive
+/* Take in a pointer to a player and makes it inactive, freeing
+ * the known and visible arrays, which an inactive player never needs
  *
  * We return:
  *   nothing
@@ -28,7 +32,8 @@ player_t* player_new(addr_t address, char* name, int x, int y, char letter);
 void player_inactive(player_t* player);
 
 
-/* Take in a pointer to a player and deletes it + frees up the space
+/* Take in a pointer to a player and deletes it, freeing the known and
+ * visible arrays; the player itself goes when the arena is deleted
  *
  * We return:
  *   nothing
@@ -126,6 +131,38 @@ void set_gold(player_t* player, int gold);
  */
 bool isActive(player_t* player);    
 
+/* Take in a pointer to a player
+ *
+ * We return:
+ *   true if the player is a bot run by the server itself, which has
+ *   no address and is never sent any messages; false otherwise
+ */
+bool isBot(player_t* player);
+
+/* Take in a pointer to a player and a keystroke, and queue the
+ * keystroke to be applied at the next simulation tick.
+ *
+ * We return:
+ *   true if queued, false if the player's queue is full
+ */
+bool player_queueKey(player_t* player, char key);
+
+/* Take in a pointer to a player and remove the oldest queued keystroke.
+ *
+ * We return:
+ *   the keystroke, or '\0' if none is queued
+ */
+char player_nextKey(player_t* player);
+
+/* Take in two pointers to players, either of which may be NULL, and
+ * compare their oldest queued keystrokes.
+ *
+ * We return:
+ *   true if 'player' has a keystroke queued that arrived before any
+ *   queued by 'other' (or 'other' has none); false otherwise
+ */
+bool player_keyBefore(player_t* player, player_t* other);
+
 /* Given a row and col, tell if the player currently sees
  * that point.
  *
@@ -144,8 +181,38 @@ bool isVisible(player_t* player, const int row, const int col);
 bool isKnown(player_t* player, const int row, const int col);
 
 
+/* Take in a pointer to a player
+ *
+ * We return:
+ *   the player's known array: one bool per grid point, row by row
+ *   (index row*getnColumns()+col), true where the point has been seen;
+ *   NULL before the player's first updateVisibility, or once inactive
+ */
+const bool* get_known(player_t* player);
+
+/* Take in a pointer to a player
+ *
+ * We return:
+ *   the player's visible array, laid out like get_known's, true where
+ *   the point is currently visible
+ */
+const bool* get_visible(player_t* player);
+
+/* Take in a pointer to a player
+ *
+ * We return:
+ *   the bytes of memory the player holds: the record, the name, and
+ *   the fog planes if allocated; if 'fog' is not NULL, the bytes in
+ *   the fog planes alone are stored there
+ */
+size_t player_memory(player_t* player, size_t* fog);
+
 /* Updates visibility by changing the values of the known
- * and visible boolean arrays.
+ * and visible boolean arrays, allocating them the first time.
+ * Visibility depends only on the player's position (gold
+ * pickups never change what blocks sight), so this does
+ * nothing if the player has not moved since the last update.
+ * An inactive player's arrays are freed, and not updated.
  *
  * We return:
  *   nothing
@@ -0,0 +1,154 @@
+/*
+ * compose.c - the render module's row kernel
+ *
+ * see compose.h for more information.
+ *
+ * Binary Brigade, Spring 2023
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "compose.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COMPOSE_X86
+#include <immintrin.h>
+#endif
+
+/**************** local types ****************/
+typedef void (*kernel_t)(char* out, const char* terrain, const bool* known,
+                         const bool* visible, const char* occupants, const int n);
+
+/**************** local functions ****************/
+static void composeScalar(char* out, const char* terrain, const bool* known,
+                          const bool* visible, const char* occupants, const int n);
+#ifdef COMPOSE_X86
+static void composeSSE2(char* out, const char* terrain, const bool* known,
+                        const bool* visible, const char* occupants, const int n);
+static void composeAVX2(char* out, const char* terrain, const bool* known,
+                        const bool* visible, const char* occupants, const int n);
+#endif
+
+/**************** global variables ****************/
+static kernel_t kernel = NULL;
+static const char* kernelName = "scalar";
+
+/**************** compose_init ****************/
+/* see compose.h for description */
+void
+compose_init(void)
+{
+  kernel = composeScalar;
+  kernelName = "scalar";
+
+#ifdef COMPOSE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernel = composeAVX2;
+    kernelName = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    kernel = composeSSE2;
+    kernelName = "sse2";
+  }
+#endif
+}
+
+/**************** compose_row ****************/
+/* see compose.h for description */
+void
+compose_row(char* out, const char* terrain, const bool* known,
+            const bool* visible, const char* occupants, const int n)
+{
+  if (kernel == NULL) {
+    compose_init();
+  }
+  (*kernel)(out, terrain, known, visible, occupants, n);
+}
+
+/**************** compose_name ****************/
+/* see compose.h for description */
+const char*
+compose_name(void)
+{
+  if (kernel == NULL) {
+    compose_init();
+  }
+  return kernelName;
+}
+
+/**************** composeScalar ****************/
+/* The portable kernel, written with masks rather than branches so the
+ * compiler is free to vectorize it too.
+ */
+static void
+composeScalar(char* out, const char* terrain, const bool* known,
+              const bool* visible, const char* occupants, const int n)
+{
+  for (int i = 0; i < n; i++) {
+    const unsigned char knownMask = -(unsigned char)known[i];
+    const unsigned char showMask = -(unsigned char)(visible[i] & (occupants[i] != 0));
+    const unsigned char base = (terrain[i] & knownMask) | (' ' & ~knownMask);
+    out[i] = (occupants[i] & showMask) | (base & ~showMask);
+  }
+}
+
+#ifdef COMPOSE_X86
+/**************** composeSSE2 ****************/
+/* 16 points at a time; the remainder goes to the scalar kernel.
+ */
+__attribute__((target("sse2")))
+static void
+composeSSE2(char* out, const char* terrain, const bool* known,
+            const bool* visible, const char* occupants, const int n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i blank = _mm_set1_epi8(' ');
+  int i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    __m128i t = _mm_loadu_si128((const __m128i*)(terrain + i));
+    __m128i k = _mm_loadu_si128((const __m128i*)(known + i));
+    __m128i v = _mm_loadu_si128((const __m128i*)(visible + i));
+    __m128i o = _mm_loadu_si128((const __m128i*)(occupants + i));
+
+    // all ones where the point is unknown / hidden / unoccupied
+    __m128i unknown = _mm_cmpeq_epi8(k, zero);
+    __m128i hidden = _mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(o, zero));
+
+    __m128i base = _mm_or_si128(_mm_andnot_si128(unknown, t), _mm_and_si128(unknown, blank));
+    __m128i result = _mm_or_si128(_mm_andnot_si128(hidden, o), _mm_and_si128(hidden, base));
+    _mm_storeu_si128((__m128i*)(out + i), result);
+  }
+  composeScalar(out + i, terrain + i, known + i, visible + i, occupants + i, n - i);
+}
+
+/**************** composeAVX2 ****************/
+/* 32 points at a time, using byte blends; the remainder goes to the
+ * SSE2 kernel. Compiled for AVX2 regardless of the build's target, and
+ * only called once compose_init has seen the CPU supports it.
+ */
+__attribute__((target("avx2")))
+static void
+composeAVX2(char* out, const char* terrain, const bool* known,
+            const bool* visible, const char* occupants, const int n)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i blank = _mm256_set1_epi8(' ');
+  int i = 0;
+
+  for (; i + 32 <= n; i += 32) {
+    __m256i t = _mm256_loadu_si256((const __m256i*)(terrain + i));
+    __m256i k = _mm256_loadu_si256((const __m256i*)(known + i));
+    __m256i v = _mm256_loadu_si256((const __m256i*)(visible + i));
+    __m256i o = _mm256_loadu_si256((const __m256i*)(occupants + i));
+
+    __m256i unknown = _mm256_cmpeq_epi8(k, zero);
+    __m256i hidden = _mm256_or_si256(_mm256_cmpeq_epi8(v, zero), _mm256_cmpeq_epi8(o, zero));
+
+    __m256i base = _mm256_blendv_epi8(t, blank, unknown);
+    __m256i result = _mm256_blendv_epi8(o, base, hidden);
+    _mm256_storeu_si256((__m256i*)(out + i), result);
+  }
+  composeSSE2(out + i, terrain + i, known + i, visible + i, occupants + i, n - i);
+}
+#endif
@@ -0,0 +1,37 @@
+/*
+ * compose.h - header file for the render module's row kernel
+ *
+ * Composes one row of a player's display from four planes, without
+ * branching per point:
+ *   out = (visible && occupant) ? occupant : (known ? terrain : ' ')
+ * where an occupant of 0 means the point holds no gold and no player.
+ * On x86 the kernel uses AVX2 or SSE2, whichever the running CPU
+ * supports; elsewhere, and for the tail of each row, it is plain C.
+ *
+ * Binary Brigade, Spring 2023
+ */
+
+#ifndef _COMPOSE_H_
+#define _COMPOSE_H_
+
+#include <stdbool.h>
+
+/**************** compose_init ****************/
+/* Chooses the fastest kernel the CPU supports. Safe to call more than
+ * once; compose_row calls it if needed.
+ */
+void compose_init(void);
+
+/**************** compose_row ****************/
+/* Writes 'n' bytes of output, one per point of the row, from the
+ * row's terrain, known, visible, and occupant planes.
+ */
+void compose_row(char* out, const char* terrain, const bool* known,
+                 const bool* visible, const char* occupants, const int n);
+
+/**************** compose_name ****************/
+/* Returns the name of the kernel in use: "avx2", "sse2", or "scalar".
+ */
+const char* compose_name(void);
+
+#endif // _COMPOSE_H_
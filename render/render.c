@@ -0,0 +1,406 @@
+/*
+ * render.c - Nuggets 'render' module
+ *
+ * see render.h for more information.
+ *
+ * Binary Brigade, Spring 2023
+ */
+
+// allocations here are counted against the render subsystem (see mem.h)
+#define MEM_SUBSYSTEM mem_render
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include "render.h"
+#include "compose.h"
+#include "../grid/grid.h"
+#include "../player/player.h"
+#include "../lib/mem.h"
+
+/**************** local constants ****************/
+static const char* header = "DISPLAY \n";
+static const int maxFrames = 26;          // one per player letter
+
+/**************** local types ****************/
+typedef struct renderer {
+  int nRows;
+  int nColumns;
+  int stride;             // bytes per rendered row, newline included
+  int frameSize;          // header, every row, and the terminating null
+  char* layer;            // terrain as displayed, gold shown as '.'
+  char* occupants;        // per point: '*', a player's letter, or 0 if empty
+  int* marked;            // the points currently set in 'occupants'
+  int nMarked;
+  unsigned long occupantsVersion;   // grid version 'occupants' reflects
+  bool occupantsFresh;    // false until 'occupants' is first filled in
+  bool* everything;       // all true: the spectator knows and sees it all
+  gridpoint_t** gold;     // points that held gold; collected ones drop out
+  int nGold;
+  char** frames;          // per-player message buffers, by letter
+  char* spectatorFrame;
+  unsigned long spectatorVersion;   // grid version the spectator frame shows
+  bool spectatorFresh;    // false until the spectator frame is first built
+  char* clip;             // the last window cut by render_clip
+  int clipSize;
+} renderer_t;
+
+/**************** global variables ****************/
+static renderer_t* renderer = NULL;
+
+/**************** local functions ****************/
+static char* frameBuffer(char** frame);
+static void refreshOccupants(player_t** players, const int nPlayers);
+static void markOccupant(const int row, const int column, const char occupant);
+static void composeFrame(char* out, const bool* known, const bool* visible);
+static void patchSpectator(char* out);
+static void clampViewport(viewport_t* viewport);
+
+/**************** render_init ****************/
+/* see render.h for description */
+void
+render_init(void)
+{
+  renderer = mem_malloc_assert(sizeof(renderer_t), "renderer");
+  renderer->nRows = getnRows();
+  renderer->nColumns = getnColumns();
+  renderer->stride = renderer->nColumns + 1;
+  renderer->frameSize = strlen(header) + renderer->nRows * renderer->stride + 1;
+  renderer->layer = mem_malloc_assert(renderer->nRows * renderer->stride, "terrain layer");
+  renderer->frames = mem_calloc_assert(maxFrames, sizeof(char*), "frames");
+  renderer->spectatorFrame = NULL;
+  renderer->spectatorFresh = false;
+  renderer->clip = NULL;
+  renderer->clipSize = 0;
+  compose_init();
+
+  // Counting the gold piles, to size their list
+  int nGold = 0;
+  for (int row = 0; row < renderer->nRows; row++) {
+    for (int column = 0; column < renderer->nColumns; column++) {
+      if (getTerrain(getPoint(row, column)) == '*') {
+        nGold++;
+      }
+    }
+  }
+  renderer->gold = mem_malloc_assert((nGold > 0 ? nGold : 1) * sizeof(gridpoint_t*), "gold list");
+  renderer->nGold = 0;
+
+  // Every pile and every player may be marked at once
+  const int nPoints = renderer->nRows * renderer->nColumns;
+  renderer->occupants = mem_calloc_assert(nPoints, sizeof(char), "occupants");
+  renderer->marked = mem_malloc_assert((nGold + maxFrames) * sizeof(int), "marked");
+  renderer->nMarked = 0;
+  renderer->occupantsFresh = false;
+  renderer->everything = mem_malloc_assert(nPoints * sizeof(bool), "everything");
+  for (int i = 0; i < nPoints; i++) {
+    renderer->everything[i] = true;
+  }
+
+  // Pre-rendering the terrain, and listing the gold piles
+  for (int row = 0; row < renderer->nRows; row++) {
+    char* line = renderer->layer + row * renderer->stride;
+    for (int column = 0; column < renderer->nColumns; column++) {
+      gridpoint_t* point = getPoint(row, column);
+      if (getTerrain(point) == '*') {
+        renderer->gold[renderer->nGold++] = point;
+        line[column] = '.';
+      } else {
+        line[column] = getTerrain(point);
+      }
+    }
+    line[renderer->nColumns] = '\n';
+  }
+}
+
+/**************** render_player ****************/
+/* see render.h for description */
+const char*
+render_player(player_t* player, player_t** players, const int nPlayers)
+{
+  int index = get_letter(player) - 'A';
+  if (index < 0 || index >= maxFrames) {
+    return NULL;
+  }
+  char* frame = frameBuffer(&renderer->frames[index]);
+  char* out = frame + strlen(header);
+
+  refreshOccupants(players, nPlayers);
+  composeFrame(out, get_known(player), get_visible(player));
+
+  // The player sees themself as '@'
+  const int row = get_y(player);
+  const int column = get_x(player);
+  const int point = row * renderer->nColumns + column;
+  if (renderer->occupants[point] == get_letter(player) && get_visible(player)[point]) {
+    out[row * renderer->stride + column] = '@';
+  }
+  return frame;
+}
+
+/**************** render_spectator ****************/
+/* see render.h for description */
+const char*
+render_spectator(player_t** players, const int nPlayers)
+{
+  char* frame = frameBuffer(&renderer->spectatorFrame);
+  char* out = frame + strlen(header);
+
+  if (renderer->spectatorFresh && renderer->spectatorVersion == gridVersion()) {
+    return frame;
+  }
+
+  // Patching only the changed points when the change log covers them all
+  if (renderer->spectatorFresh && !gridChangesOverflowed()
+      && renderer->spectatorVersion >= gridChangesSince()) {
+    patchSpectator(out);
+  } else {
+    refreshOccupants(players, nPlayers);
+    composeFrame(out, renderer->everything, renderer->everything);
+  }
+
+  renderer->spectatorVersion = gridVersion();
+  renderer->spectatorFresh = true;
+  return frame;
+}
+
+/**************** render_clip ****************/
+/* see render.h for description */
+const char*
+render_clip(const char* frame, const viewport_t* viewport)
+{
+  if (frame == NULL || viewport->rows <= 0) {
+    return frame;
+  }
+
+  // Room for the header with two numbers, the window, and the null
+  const int size = 32 + viewport->rows * (viewport->cols + 1) + 1;
+  if (renderer->clipSize < size) {
+    if (renderer->clip != NULL) {
+      mem_free(renderer->clip);
+    }
+    renderer->clip = mem_malloc_assert(size, "clip");
+    renderer->clipSize = size;
+  }
+
+  const char* in = frame + strlen(header) + viewport->top * renderer->stride + viewport->left;
+  char* out = renderer->clip + sprintf(renderer->clip, "DISPLAY %d %d\n", viewport->top, viewport->left);
+  for (int row = 0; row < viewport->rows; row++) {
+    memcpy(out, in, viewport->cols);
+    out[viewport->cols] = '\n';
+    out += viewport->cols + 1;
+    in += renderer->stride;
+  }
+  *out = '\0';
+  return renderer->clip;
+}
+
+/**************** viewport_resize ****************/
+/* see render.h for description */
+void
+viewport_resize(viewport_t* viewport, const int rows, const int cols)
+{
+  if (rows >= renderer->nRows && cols >= renderer->nColumns) {
+    viewport->rows = 0;
+    viewport->cols = 0;
+    viewport->top = 0;
+    viewport->left = 0;
+    return;
+  }
+  viewport->rows = (rows < renderer->nRows) ? rows : renderer->nRows;
+  viewport->cols = (cols < renderer->nColumns) ? cols : renderer->nColumns;
+  clampViewport(viewport);
+}
+
+/**************** viewport_follow ****************/
+/* see render.h for description */
+bool
+viewport_follow(viewport_t* viewport, const int row, const int column)
+{
+  if (viewport->rows <= 0) {
+    return false;
+  }
+  const int top = viewport->top;
+  const int left = viewport->left;
+  const int rowMargin = viewport->rows / 4;
+  const int colMargin = viewport->cols / 4;
+
+  if (row < top + rowMargin || row >= top + viewport->rows - rowMargin) {
+    viewport->top = row - viewport->rows / 2;
+  }
+  if (column < left + colMargin || column >= left + viewport->cols - colMargin) {
+    viewport->left = column - viewport->cols / 2;
+  }
+  clampViewport(viewport);
+  return viewport->top != top || viewport->left != left;
+}
+
+/**************** viewport_pan ****************/
+/* see render.h for description */
+bool
+viewport_pan(viewport_t* viewport, const int dRows, const int dCols)
+{
+  if (viewport->rows <= 0) {
+    return false;
+  }
+  const int top = viewport->top;
+  const int left = viewport->left;
+  viewport->top += dRows;
+  viewport->left += dCols;
+  clampViewport(viewport);
+  return viewport->top != top || viewport->left != left;
+}
+
+/**************** render_delete ****************/
+/* see render.h for description */
+void
+render_delete(void)
+{
+  if (renderer != NULL) {
+    for (int i = 0; i < maxFrames; i++) {
+      if (renderer->frames[i] != NULL) {
+        mem_free(renderer->frames[i]);
+      }
+    }
+    if (renderer->spectatorFrame != NULL) {
+      mem_free(renderer->spectatorFrame);
+    }
+    if (renderer->clip != NULL) {
+      mem_free(renderer->clip);
+    }
+    mem_free(renderer->frames);
+    mem_free(renderer->occupants);
+    mem_free(renderer->marked);
+    mem_free(renderer->everything);
+    mem_free(renderer->gold);
+    mem_free(renderer->layer);
+    mem_free(renderer);
+    renderer = NULL;
+  }
+}
+
+/**************** frameBuffer ****************/
+/* Returns the frame buffer, allocating it (with its header, row
+ * newlines, and terminating null already in place) on first use.
+ */
+static char*
+frameBuffer(char** frame)
+{
+  if (*frame == NULL) {
+    *frame = mem_malloc_assert(renderer->frameSize, "frame");
+    strcpy(*frame, header);
+    memcpy(*frame + strlen(header), renderer->layer, renderer->nRows * renderer->stride);
+    (*frame)[renderer->frameSize - 1] = '\0';
+  }
+  return *frame;
+}
+
+/**************** refreshOccupants ****************/
+/* Brings the occupant plane up to date with the grid: clears the points
+ * marked last time, then marks each remaining gold pile and each active
+ * player's spot. Does nothing if the grid has not changed since.
+ * Piles that have been collected are dropped from the list as they are
+ * found.
+ */
+static void
+refreshOccupants(player_t** players, const int nPlayers)
+{
+  if (renderer->occupantsFresh && renderer->occupantsVersion == gridVersion()) {
+    return;
+  }
+
+  for (int i = 0; i < renderer->nMarked; i++) {
+    renderer->occupants[renderer->marked[i]] = 0;
+  }
+  renderer->nMarked = 0;
+
+  for (int i = 0; i < renderer->nGold; i++) {
+    gridpoint_t* point = renderer->gold[i];
+    if (getTerrain(point) != '*') {
+      renderer->gold[i--] = renderer->gold[--renderer->nGold];
+    } else {
+      markOccupant(getPointRow(point), getPointColumn(point), '*');
+    }
+  }
+
+  // Players are marked last, so they cover any gold beneath them
+  for (int i = 0; i < nPlayers && players[i] != NULL && i < maxFrames; i++) {
+    if (isActive(players[i])) {
+      const int row = get_y(players[i]);
+      const int column = get_x(players[i]);
+      const char occupant = getPlayer(getPoint(row, column));
+      if (isalpha(occupant)) {
+        markOccupant(row, column, occupant);
+      }
+    }
+  }
+
+  renderer->occupantsVersion = gridVersion();
+  renderer->occupantsFresh = true;
+}
+
+/**************** markOccupant ****************/
+/* Sets one point of the occupant plane, remembering it for clearing.
+ */
+static void
+markOccupant(const int row, const int column, const char occupant)
+{
+  const int point = row * renderer->nColumns + column;
+  renderer->occupants[point] = occupant;
+  renderer->marked[renderer->nMarked++] = point;
+}
+
+/**************** composeFrame ****************/
+/* Composes every row of the frame from the terrain layer, the given
+ * known and visible planes, and the occupant plane. Row newlines,
+ * already in the frame buffer, are left untouched.
+ */
+static void
+composeFrame(char* out, const bool* known, const bool* visible)
+{
+  const int nColumns = renderer->nColumns;
+  for (int row = 0; row < renderer->nRows; row++) {
+    compose_row(out + row * renderer->stride,
+                renderer->layer + row * renderer->stride,
+                known + row * nColumns, visible + row * nColumns,
+                renderer->occupants + row * nColumns, nColumns);
+  }
+}
+
+/**************** patchSpectator ****************/
+/* Redraws, in the spectator frame, each point in the grid's change log:
+ * its occupant if there is one, otherwise its terrain (gold as '*').
+ * Points already up to date are simply drawn again.
+ */
+static void
+patchSpectator(char* out)
+{
+  for (int i = 0; i < gridChangeCount(); i++) {
+    gridpoint_t* point = gridChangeAt(i);
+    const char occupant = getPlayer(point);
+    out[getPointRow(point) * renderer->stride + getPointColumn(point)] =
+      isalpha(occupant) ? occupant : getTerrain(point);
+  }
+}
+
+/**************** clampViewport ****************/
+/* Moves the window, if need be, so that it lies within the map.
+ */
+static void
+clampViewport(viewport_t* viewport)
+{
+  if (viewport->top > renderer->nRows - viewport->rows) {
+    viewport->top = renderer->nRows - viewport->rows;
+  }
+  if (viewport->top < 0) {
+    viewport->top = 0;
+  }
+  if (viewport->left > renderer->nColumns - viewport->cols) {
+    viewport->left = renderer->nColumns - viewport->cols;
+  }
+  if (viewport->left < 0) {
+    viewport->left = 0;
+  }
+}
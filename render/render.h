@@ -0,0 +1,111 @@
+/*
+ * render.h - header file for Nuggets render module
+ *
+ * The render module turns the grid into DISPLAY messages. It keeps
+ * one pre-rendered terrain layer for the map (gold drawn as the room
+ * spot underneath it), and builds each frame by masking that layer
+ * with the player's known points, then overlaying the few things that
+ * move: visible gold piles and visible occupants. Each frame is built
+ * in a buffer kept for that player and reused for every frame, so
+ * rendering allocates nothing once the game is under way.
+ *
+ * Binary Brigade, Spring 2023
+ */
+
+#ifndef _RENDER_H_
+#define _RENDER_H_
+
+#include <stdbool.h>
+#include "../grid/grid.h"
+#include "../player/player.h"
+
+/**************** global types ****************/
+/* A client's window onto the map: 'rows' by 'cols' points whose top
+ * left corner is at ('top', 'left'). A viewport of 0 rows shows the
+ * whole map, in the original DISPLAY format.
+ */
+typedef struct viewport {
+  int rows;
+  int cols;
+  int top;
+  int left;
+} viewport_t;
+
+/**************** render_init ****************/
+/* Builds the terrain layer and the list of gold piles from the
+ * current grid. Call once the grid is initialized and its gold placed;
+ * call render_delete when done.
+ */
+void render_init(void);
+
+/**************** render_player ****************/
+/* Renders the player's view of the grid as a complete DISPLAY message,
+ * given the array of players (NULL-terminated, or full at maxPlayers)
+ * so that visible occupants can be drawn; the player itself is '@'.
+ * The player's visibility must be up to date.
+ *
+ * We return:
+ *   the message, in a buffer owned by the render module that is
+ *   overwritten by the next frame for the same player.
+ */
+const char* render_player(player_t* player, player_t** players, const int nPlayers);
+
+/**************** render_spectator ****************/
+/* Renders the whole grid, with all gold and all occupants, as a
+ * complete DISPLAY message. The spectator frame is kept between calls:
+ * if the grid has not changed it is returned as is, and if every change
+ * since it was drawn is still in the grid's change log, only those
+ * points are redrawn. Otherwise it is composed afresh.
+ *
+ * We return:
+ *   the message, in a buffer owned by the render module that is
+ *   overwritten by the next spectator frame.
+ */
+const char* render_spectator(player_t** players, const int nPlayers);
+
+/**************** render_clip ****************/
+/* Cuts the viewport's window out of a frame returned by render_player
+ * or render_spectator, as a DISPLAY message whose header gives the
+ * window's top left corner:
+ *   DISPLAY top left
+ * followed by the window's rows, each ending in a newline.
+ *
+ * We return:
+ *   the message, in a buffer owned by the render module that is
+ *   overwritten by the next call; the frame itself if the viewport
+ *   shows the whole map.
+ */
+const char* render_clip(const char* frame, const viewport_t* viewport);
+
+/**************** viewport_resize ****************/
+/* Sets the viewport to the given size, keeping its corner where it
+ * can; a viewport at least as large as the map shows the whole map.
+ */
+void viewport_resize(viewport_t* viewport, const int rows, const int cols);
+
+/**************** viewport_follow ****************/
+/* Keeps the given point comfortably inside the viewport: if the point
+ * is within a quarter of the window of an edge (or outside it), the
+ * window is re-centred on it. The window otherwise stays put, so most
+ * moves do not scroll it.
+ *
+ * We return:
+ *   true if the window moved.
+ */
+bool viewport_follow(viewport_t* viewport, const int row, const int column);
+
+/**************** viewport_pan ****************/
+/* Moves the window by the given number of rows and columns, stopping
+ * at the edges of the map.
+ *
+ * We return:
+ *   true if the window moved.
+ */
+bool viewport_pan(viewport_t* viewport, const int dRows, const int dCols);
+
+/**************** render_delete ****************/
+/* Frees the terrain layer and every frame buffer.
+ */
+void render_delete(void);
+
+#endif // _RENDER_H_
@@ -11,39 +11,102 @@
  * Binary Brigade, Spring, 2023
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <signal.h>
 #include "../support/message.h"
 #include "../grid/grid.h"
 #include "../game/game.h"
 #include "../player/player.h"
 #include "../lib/mem.h"
 #include "../support/log.h"
+#include "../support/binlog.h"
+#include "../lib/timing.h"
+#include "../lib/scratch.h"
+#include "../lib/trace.h"
+#include "../outbox/outbox.h"
+#include "../stats/stats.h"
 
 /**************** local global types ****************/
 static const int maxPlayers = 26;
+static const float botRate = 8;            // steps per second each bot takes
+static const float flushInterval = 0.02;   // seconds between flushes while messages wait
+static const float signalWake = 0.001;     // seconds before a signal is answered when idle
+
+// settings from the command line
+static struct {
+  char* mapPath;
+  int randomSeed;
+  int rate;           // outbound bytes per second per client; 0 is unlimited
+  float tickRate;     // simulation ticks per second; 0 applies keys at once
+  int bots;           // players run by the server itself
+  char* logPath;      // binary log of every message (see binlog.h), or NULL
+  bool logging;       // text log to stderr, at the level set with log_setLevel
+  struct in_addr statsAllowed[16];  // hosts that may ask for STATS;
+  int nStatsAllowed;                //   none unless named, loopback too
+  char* tracePath;    // Chrome trace of the session (see trace.h), or NULL
+} options;
+
+// what changed while applying keystrokes, not yet sent to the clients
+static struct {
+  bool moved;         // some player changed position, or joined
+  bool goldChanged;   // some player picked up gold
+  int collected[26];  // gold picked up, indexed like the players array
+} turn;
+
+static int64_t tickPeriod;  // nanoseconds between ticks
+static int64_t nextTick;    // time at which the next tick is due
+static int64_t received;    // time at which the message being handled arrived
+static int64_t botPeriod;   // nanoseconds between bot steps
+static int64_t nextBotStep; // time at which the bots next step
+static mem_arena_t* matchArena;  // grid, game, and players, freed together
+static volatile sig_atomic_t statsAsked;  // SIGUSR1 arrived; print the stats
+static volatile sig_atomic_t traceAsked;  // SIGUSR2 arrived; write the trace
+static volatile sig_atomic_t stopAsked;   // SIGINT or SIGTERM arrived while tracing
 
 /**************** file-local functions ****************/
 
+static bool parseArgs(int argc, char* argv[]);
 static bool handleMessage(void* arg, const addr_t from, const char* message);
+static bool handleTimeout(void* arg);
+static bool processMessage(const addr_t from, const char* message);
+static void applyKey(player_t* player, const char key);
+static bool publishTurn(void);
+static void broadcastDisplays(void);
+static bool runTick(void);
+static bool runBots(void);
+static void addBots(void);
+static bool humansPlaying(void);
+static float loopTimeout(void);
 static void goldUpdate(addr_t address, player_t* player, int collected);
 static void spectatorGoldUpdate(addr_t address);
+static void reportLatency(void);
+static void reportMemory(void);
+static void catchSignals(void);
+static void noteSignal(int signal);
+static bool answerSignals(void);
+static bool statsAllowed(const addr_t from);
+static const char* buildStats(void);
 
 /***************** main *******************************/
+#ifndef UNIT_TEST
 int 
 main(int argc, char *argv[])
 { 
-  
-  if (argc != 2 && argc != 3){
-    fprintf(stderr, "invalid number of arguments -- must have either 1 or 2 arguments (mapfile and randomSeed)\n");
+  if (!parseArgs(argc, argv)) {
+    fprintf(stderr, "usage: %s [--rate bytesPerSecond] [--tick hz] [--bots n] [--log file] [--log-level level] [--stats-allow host] [--trace file] map.txt [randomSeed]\n", argv[0]);
     return 1;
   }
 
   FILE *fp;
-  fp = fopen(argv[1], "r");
+  fp = fopen(options.mapPath, "r");
   
   if (fp == NULL){
     fprintf(stderr, "Map txt file is not a readable file\n");
@@ -51,18 +114,21 @@ main(int argc, char *argv[])
   }
   fclose(fp);
 
-  int randomSeed;
-  
-  if (argc == 3){
-    randomSeed = atoi(argv[2]);
-  
-  } else {
-    randomSeed = getpid();
+  // everything that lives as long as the match comes from one arena
+  matchArena = mem_assert(mem_arena_new(0), "match arena");
+  grid_t* grid = gridInit(options.mapPath, options.randomSeed, matchArena);
+  if (grid == NULL) {
+    fprintf(stderr, "Map txt file is empty\n");
+    return 2;
   }
 
-  grid_t* grid = gridInit(argv[1], randomSeed);
+  initialize_game(grid, matchArena);
+  outbox_init(options.rate);
+  addBots();
 
-  initialize_game(grid);
+  if (options.logging) {
+    log_init(stderr);
+  }
 
   // initialize the message module (without logging)
   int myPort = message_init(NULL);
@@ -72,173 +138,598 @@ main(int argc, char *argv[])
   } else {
     printf("Ready to play, waiting at port %d\n", myPort);
   }
+  if (options.logPath != NULL && !binlog_init(options.logPath)) {
+    fprintf(stderr, "cannot write the message log '%s'\n", options.logPath);
+    return 3;
+  }
+  if (options.tracePath != NULL && !trace_open(options.tracePath, 0)) {
+    fprintf(stderr, "cannot trace: out of memory\n");
+    return 3;
+  }
+
+  if (options.tickRate > 0) {
+    tickPeriod = 1e9 / options.tickRate;
+    nextTick = timing_now() + tickPeriod;
+  }
+  if (options.bots > 0) {
+    botPeriod = 1e9 / botRate;
+    nextBotStep = timing_now() + botPeriod;
+  }
+
+  catchSignals();
+  bool ok = message_loop(NULL, loopTimeout(), handleTimeout, NULL, handleMessage);
 
-  bool ok = message_loop(NULL, 0, NULL, NULL, handleMessage);
+  reportLatency();
+  reportMemory();
+  stats_report(stdout);
+  if (options.tracePath != NULL) {
+    if (trace_dropped() > 0) {
+      printf("Trace dropped %zu spans\n", trace_dropped());
+    }
+    if (!trace_close()) {
+      fprintf(stderr, "cannot write the trace '%s'\n", options.tracePath);
+    }
+  }
 
   // shut down the message module
+  outbox_done();
   message_done();
+  binlog_done();
+  if (binlog_dropped() > 0) {
+    printf("Message log dropped %ld records\n", binlog_dropped());
+  }
   delete_game();
   gridDelete();
+  mem_arena_delete(matchArena);
+  scratch_done();
+  log_done();
   
   return ok? 0 : 4; // status code depends on result of message_loop
 }
+#endif // UNIT_TEST
+
+/**************** parseArgs ****************/
+/* 
+ * Parses the command line into the file-local 'options':
+ *   [--rate bytesPerSecond] [--tick hz] [--bots n] [--log file] [--log-level level] [--stats-allow host] [--trace file] map.txt [randomSeed]
+ * Without a seed, the process id is used.
+ * 
+ * We return:
+ *   true if the arguments are valid; false otherwise
+ */
+static bool
+parseArgs(int argc, char* argv[])
+{
+  static const struct option longOptions[] = {
+    { "rate", required_argument, NULL, 'r' },
+    { "tick", required_argument, NULL, 't' },
+    { "bots", required_argument, NULL, 'b' },
+    { "log", required_argument, NULL, 'l' },
+    { "log-level", required_argument, NULL, 'v' },
+    { "stats-allow", required_argument, NULL, 's' },
+    { "trace", required_argument, NULL, 'T' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  options.rate = 0;
+  options.tickRate = 0;
+  options.bots = 0;
+  options.logPath = NULL;
+  options.logging = false;
+  options.nStatsAllowed = 0;
+  options.tracePath = NULL;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+    switch (opt) {
+      case 'r':
+        options.rate = atoi(optarg);
+        if (options.rate <= 0) {
+          fprintf(stderr, "--rate must be a positive number of bytes per second\n");
+          return false;
+        }
+        break;
+      case 't':
+        options.tickRate = atof(optarg);
+        if (options.tickRate <= 0 || options.tickRate > 1000) {
+          fprintf(stderr, "--tick must be between 0 and 1000 ticks per second\n");
+          return false;
+        }
+        break;
+      case 'b':
+        options.bots = atoi(optarg);
+        if (options.bots < 1 || options.bots > maxPlayers) {
+          fprintf(stderr, "--bots must be between 1 and %d\n", maxPlayers);
+          return false;
+        }
+        break;
+      case 'l':
+        options.logPath = optarg;
+        break;
+      case 'v': {
+        log_level_t level;
+        if (!log_parseLevel(optarg, &level)) {
+          fprintf(stderr, "--log-level must be error, warn, info, debug, or trace\n");
+          return false;
+        }
+        log_setLevel(level);
+        options.logging = true;
+        break;
+      }
+      case 's': {
+        addr_t host;
+        const int maxAllowed = sizeof(options.statsAllowed) / sizeof(options.statsAllowed[0]);
+        if (options.nStatsAllowed == maxAllowed) {
+          fprintf(stderr, "--stats-allow may be given at most %d times\n", maxAllowed);
+          return false;
+        }
+        if (!message_setAddr(optarg, "1024", &host)) {   // any valid port; only the host counts
+          fprintf(stderr, "--stats-allow: cannot resolve host '%s'\n", optarg);
+          return false;
+        }
+        options.statsAllowed[options.nStatsAllowed++] = host.sin_addr;
+        break;
+      }
+      case 'T':
+        options.tracePath = optarg;
+        break;
+      default:
+        return false;
+    }
+  }
+
+  // positional arguments: map file and optional random seed
+  int remaining = argc - optind;
+  if (remaining != 1 && remaining != 2) {
+    fprintf(stderr, "invalid number of arguments -- must have either 1 or 2 arguments (mapfile and randomSeed)\n");
+    return false;
+  }
+  options.mapPath = argv[optind];
+  options.randomSeed = (remaining == 2) ? atoi(argv[optind + 1]) : getpid();
+  return true;
+}
+
+/**************** handleTimeout ****************/
+/* Nothing arrived for a while; move the bots and run a tick if due, catch up
+ * capped spectators, and give paced queues a chance to drain.
+ * We ignore 'arg' here.
+ * Return true if the game is over.
+ */
+static bool
+handleTimeout(void* arg)
+{
+  int64_t start = trace_now();
+  bool gameOver = runBots() || runTick();
+
+  if (gameOver) {
+    outbox_drain();
+  } else {
+    flushSpectatorDisplays();
+    outbox_flush();
+  }
+  trace_span("handleTimeout", start);
+  // set before answering, so that a signal arriving later still wakes the loop
+  message_setTimeout(loopTimeout());
+  bool stop = answerSignals();
+  scratch_reset();
+  return gameOver || stop;
+}
 
 /**************** handleMessage ****************/
-/* Datagram received; print it, read a line from stdin, and use it as reply.
+/* Datagram received; process it, then flush whatever it queued.
  * We ignore 'arg' here.
- * Return true if EOF on stdin or any fatal error.
+ * Return true if the game is over or any fatal error.
  */
 static bool
 handleMessage(void* arg, const addr_t from, const char* message)
 {
-  // print the message and a prompt
-  printf("'%s'\n", message);
+  received = timing_now();
+  bool gameOver = processMessage(from, message) || runBots() || runTick();
+
+  // at game over everything queued must reach the clients before we exit
+  if (gameOver) {
+    outbox_drain();
+  } else {
+    flushSpectatorDisplays();
+    outbox_flush();
+  }
+
+  stats_received(message, strlen(message), timing_now() - received);
+  trace_span("handleMessage", received);
+  message_setTimeout(loopTimeout());
+  bool stop = answerSignals();
+
+  // the messages built while handling it have all been queued or sent
+  scratch_reset();
+  return gameOver || stop;
+}
+
+/**************** processMessage ****************/
+/* Update the game for one inbound message, queueing the replies.
+ * Return true if the game is over.
+ */
+static bool
+processMessage(const addr_t from, const char* message)
+{
+  log_at(log_trace, "from %s: '%s'", message_stringAddr(from), message);
+  spectator_heard(from);
 
   //client has input play
   if (strncmp(message, "PLAY ", strlen("PLAY ")) == 0) {
-    char name[strlen(message) - 5];
+    char name[strlen(message) - 5 + 1];
     
     strcpy(name, message + 5);
 
     if (strlen(name) == 0){
       //sending message to client that name is empty
-      message_send(from, "QUIT Sorry - you must provide player's name.");
+      outbox_reply(from, "QUIT Sorry - you must provide player's name.");
     
     } else {
       
       char letter = ' ';
-      player_t* player = player_new(from, name, 0, 0, letter);
+      player_t* player = game_full() ? NULL : player_new(from, name, 0, 0, letter, matchArena);
       
-      if (add_player(player) != 0){
+      if (player == NULL || add_player(player) != 0){
 
-        message_send(from, "QUIT Game is full: no more players can join.\n");
+        outbox_reply(from, "QUIT Game is full: no more players can join.\n");
       
       } else {
         placePlayer(player);
-        char letter = get_letter(player);
-        
-        char* line = mem_malloc(sizeof(char)*5);
-        strcpy(line, "OK ");
-        int temp = strlen(line);
-        line[temp] = letter;
-        line[temp+1] = '\0';
-
-        message_send(from, line); //sending ok and letter of player
-        mem_free(line);
-
-        //sending grid dimensions, gold update, and display
+
+        //sending ok and letter of player
+        outbox_send(from, scratch_printf("OK %c", get_letter(player)));
+
+        //sending grid dimensions, gold update, and display to everyone
         get_grid_dimensions(from);
         goldUpdate(from, player, 0);
-        gridDisplay(from, player);
-
-        player_t** players = get_players();
-        for (int i = 0; i < maxPlayers; i++) {
-          if (players[i] != NULL && !message_eqAddr(from, get_address(players[i]))){
-            gridDisplay(get_address(players[i]), players[i]);  //sends display update to all players
-          }
-        }
-        if (message_isAddr(get_spectator())){
-          gridDisplaySpectator(get_spectator());  //sends display update to spectator
+        if (options.tickRate > 0) {
+          //everyone else sees the newcomer at the next tick
+          gridDisplay(from, player);
+          turn.moved = true;
+        } else {
+          broadcastDisplays();
         }
       }
     }
   
-  //client has input spectate
-  } else if (strcmp(message, "SPECTATE") == 0) {
-    addr_t oldSpectator = add_spectator(from);
-    
-    if (message_isAddr(oldSpectator)){
-      //sending a message to the old spectator that they have been replaced
-      message_send(oldSpectator, "QUIT You have been replaced by a new spectator.");
+  //client has input spectate, optionally with a cap on frames per second
+  } else if (strcmp(message, "SPECTATE") == 0 || strncmp(message, "SPECTATE ", strlen("SPECTATE ")) == 0) {
+    float maxFrameRate = 0;
+    if (message[strlen("SPECTATE")] == ' ') {
+      maxFrameRate = atof(message + strlen("SPECTATE "));
     }
 
-    //sending grid dimensions, gold update, and display
-    get_grid_dimensions(from);
-    spectatorGoldUpdate(from);
-    gridDisplaySpectator(from);
+    if (!add_spectator(from, maxFrameRate)) {
+      outbox_reply(from, "QUIT Too many spectators: try again later.");
+    } else {
+      //sending grid dimensions, gold update, and display
+      get_grid_dimensions(from);
+      spectatorGoldUpdate(from);
+      gridDisplaySpectator(from);
+    }
   
+  //client has reported how much of the map fits on its screen
+  } else if (strncmp(message, "VIEWPORT ", strlen("VIEWPORT ")) == 0) {
+    int rows, cols;
+    if (sscanf(message + strlen("VIEWPORT "), "%d %d", &rows, &cols) != 2 || rows < 1 || cols < 1) {
+      outbox_reply(from, "ERROR malformed VIEWPORT message");
+    } else if (set_viewport(from, rows, cols)) {
+      //resending the display, cut to the new window
+      player_t* player = find_player(from);
+      if (player != NULL) {
+        if (isActive(player)) {
+          gridDisplay(from, player);
+        }
+      } else {
+        gridDisplaySpectator(from);
+      }
+    }
+
+  //client is measuring latency: "PING t [rtt]", where rtt is the
+  //client's latest round-trip time in nanoseconds; t is echoed back
+  //along with how long the server held the ping
+  } else if (strncmp(message, "PING ", strlen("PING ")) == 0) {
+    char stamp[32];
+    int64_t rtt = 0;
+    if (sscanf(message + strlen("PING "), "%31s %" SCNd64, stamp, &rtt) < 1) {
+      outbox_reply(from, "ERROR malformed PING message");
+    } else {
+      outbox_noteRtt(from, rtt);
+      outbox_reply(from, scratch_printf("PONG %s %" PRId64, stamp, timing_now() - received));
+    }
+
   //client has input a keystroke
   } else if (strncmp(message, "KEY ", strlen("KEY ")) == 0) {
     //extract key command
-    char key[strlen(message) - 4];
+    char key[strlen(message) - 4 + 1];
     strcpy(key, message + 4);
-    
-    printf("this is key: %s\n", key);
-    fflush(stdout);
-    printf("this is message: %s\n", message);
-    fflush(stdout);
+
 
     if (strcmp(key, "Q") == 0) {
       if (find_player(from) != NULL){
         player_t* player = find_player(from);
-        player_inactive(player);
-        message_send(from, "QUIT Thanks for playing!");
-      } else {
-        add_spectator(message_noAddr());
-        message_send(from, "QUIT Thanks for watching!");
+        game_inactive_player(player);
+        outbox_send(from, "QUIT Thanks for playing!");
+        outbox_forget(from);
+      } else if (remove_spectator(from)) {
+        outbox_send(from, "QUIT Thanks for watching!");
+        outbox_forget(from);
       }
-    } else if (!message_eqAddr(from, get_spectator())){
-      if (find_player(from) != NULL){
-        player_t* player = find_player(from);
+    } else if (is_spectator(from)){
+      //a spectator's movement keys pan their viewport
+      if (pan_spectator(from, *key)) {
+        gridDisplaySpectator(from);
+      }
+    } else {
+      player_t* player = find_player(from);
+      if (player != NULL && isActive(player)){
+        if (options.tickRate > 0) {
+          //applied, in order of arrival, at the next tick
+          player_queueKey(player, *key);
+        } else {
+          applyKey(player, *key);
+          return publishTurn();
+        }
+      }
+    }
+
+  //an operator's tool is asking how the server is doing
+  } else if (strcmp(message, "STATS") == 0) {
+    if (statsAllowed(from)) {
+      outbox_reply(from, buildStats());
+    } else {
+      log_at(log_warn, "STATS refused from %s", message_stringAddr(from));
+    }
+  }
+  // normal case: keep looping
+  return false;
+}
+
+/**************** applyKey ****************/
+/* 
+ * Moves the player according to one keystroke, and records in 'turn'
+ * what changed as a result.
+ */
+static void
+applyKey(player_t* player, const char key)
+{
+  //getting prev info about gold and position
+  int prevGold = get_gold(player);
+  int prevX = get_x(player);
+  int prevY = get_y(player);
+
+  movePlayer(player, key);
+
+  //comparing to see what messages need to be sent
+  if (get_gold(player) != prevGold) {
+    turn.goldChanged = true;
+    turn.collected[get_letter(player) - 'A'] += get_gold(player) - prevGold;
+  }
+  if (get_x(player) != prevX || get_y(player) != prevY) {
+    turn.moved = true;
+  }
+}
+
+/**************** publishTurn ****************/
+/* 
+ * Sends one round of updates covering everything recorded in 'turn',
+ * then clears it: gold updates if any gold was collected, and displays
+ * if anyone moved. If the last of the gold was collected, sends the
+ * game summary instead.
+ * 
+ * We return:
+ *   true if the game is over; false otherwise
+ */
+static bool
+publishTurn(void)
+{
+  player_t** players = get_players();
+  bool gameOver = false;
 
-        //getting prev info about gold and position
-        int prevGold = get_gold(player);
-        int prevAvailable = get_available_gold();
-        int prevX = get_x(player);
-        int prevY = get_y(player);
-
-        movePlayer(player, *key);
-
-        //getting updated info about gold and position
-        int newGold = get_gold(player);
-        int newAvailable = get_available_gold();
-        int newX = get_x(player);
-        int newY = get_y(player);
-
-        //comparing to see if messages needs to be sent
-        if (newGold != prevGold || prevAvailable != newAvailable){
-          if (newAvailable == 0) {    //game is over
-            player_t** players = get_players();
-            for (int i = 0; i < maxPlayers; i++) {
-              if ((players[i] != NULL) && (isActive(players[i]))) {
-                //sends game summary to all active players
-                gridDisplay(get_address(players[i]), players[i]);
-                game_summary(get_address(players[i])); 
-              }
-            }
-
-            addr_t address = get_spectator();
-            if (message_isAddr(address)){
-              game_summary(address); //sends game summary to a spectator if it exists
-            }
-            return true;
-          }
-
-          goldUpdate(from, player, newGold-prevGold);
-
-          player_t** players = get_players();
-          for (int i = 0; i < maxPlayers; i++) {
-            if (players[i] != NULL && !message_eqAddr(from, get_address(players[i]))){
-              goldUpdate(get_address(players[i]), players[i], 0); //sends game gold update to all
-            }
-          }
-          spectatorGoldUpdate(get_spectator());
+  if (turn.goldChanged) {
+    if (get_available_gold() == 0) {    //game is over
+      for (int i = 0; i < maxPlayers; i++) {
+        if ((players[i] != NULL) && (isActive(players[i])) && !isBot(players[i])) {
+          //sends game summary to all active players
+          gridDisplay(get_address(players[i]), players[i]);
+          game_summary(get_address(players[i])); 
         }
-        if (prevX != newX || prevY != newY){
-          player_t** players = get_players();
-          for (int i = 0; i < maxPlayers; i++) {
-            if (players[i] != NULL){
-              gridDisplay(get_address(players[i]), players[i]); //sends game gold update to all players
-            }
-          }
-          if (message_isAddr(get_spectator())){
-            gridDisplaySpectator(get_spectator());
-          }
+      }
+
+      game_summarySpectators(); //sends game summary to every spectator
+      gameOver = true;
+
+    } else {
+      for (int i = 0; i < maxPlayers; i++) {
+        if (players[i] != NULL && isActive(players[i]) && !isBot(players[i])) {
+          //sends each player what they collected and the game's gold update
+          goldUpdate(get_address(players[i]), players[i], turn.collected[i]);
         }
       }
+      spectatorGoldUpdate(message_noAddr());
+    }
+  }
+  if (turn.moved && !gameOver) {
+    broadcastDisplays();
+  }
+
+  memset(&turn, 0, sizeof(turn));
+  return gameOver;
+}
+
+/**************** broadcastDisplays ****************/
+/* 
+ * Sends a fresh display to every active player whose view changed,
+ * and to the spectators if anything changed, then clears the grid's
+ * change log.
+ */
+static void
+broadcastDisplays(void)
+{
+  player_t** players = get_players();
+  for (int i = 0; i < maxPlayers; i++) {
+    if (players[i] != NULL && isActive(players[i]) && !isBot(players[i])
+        && displayChanged(players[i])) {
+      gridDisplay(get_address(players[i]), players[i]);
+    }
+  }
+  if (spectator_count() > 0 && spectatorDisplayChanged()){
+    gridDisplaySpectators();
+  }
+  gridClearChanges();
+}
+
+/**************** runTick ****************/
+/* 
+ * When a tick is due, applies every player's queued keystrokes, in
+ * the order they arrived over all players, and publishes one round of
+ * updates for all of them.
+ * 
+ * We return:
+ *   true if the game is over; false otherwise
+ */
+static bool
+runTick(void)
+{
+  if (options.tickRate <= 0) {
+    return false;
+  }
+  int64_t now = timing_now();
+  if (now < nextTick) {
+    return false;
+  }
+  // a server that fell behind skips missed ticks rather than bunching them
+  nextTick += tickPeriod;
+  if (nextTick <= now) {
+    nextTick = now + tickPeriod;
+  }
+
+  // one keystroke at a time, whoever's arrived first, so that no
+  // player's letter puts their keys ahead of anyone else's
+  player_t** players = get_players();
+  while (true) {
+    player_t* first = NULL;
+    for (int i = 0; i < maxPlayers; i++) {
+      if (player_keyBefore(players[i], first)) {
+        first = players[i];
+      }
+    }
+    if (first == NULL) {
+      break;
+    }
+    char key = player_nextKey(first);
+    if (isActive(first)) {
+      applyKey(first, key);
+    }
+  }
+  return publishTurn();
+}
+
+/**************** runBots ****************/
+/* 
+ * When the bots are due to step, has each one take a step towards the
+ * nearest gold. With --tick the steps are queued for the next tick like
+ * anyone's keystrokes; otherwise they are applied and published at once.
+ * The bots hold still while no person is playing, so that they do not
+ * finish the match before anyone joins, or after everyone has left.
+ * 
+ * We return:
+ *   true if the game is over; false otherwise
+ */
+static bool
+runBots(void)
+{
+  if (options.bots == 0) {
+    return false;
+  }
+  int64_t now = timing_now();
+  if (now < nextBotStep) {
+    return false;
+  }
+  nextBotStep += botPeriod;
+  if (nextBotStep <= now) {
+    nextBotStep = now + botPeriod;
+  }
+  if (!humansPlaying()) {
+    return false;
+  }
+
+  player_t** players = get_players();
+  for (int i = 0; i < maxPlayers; i++) {
+    if (players[i] != NULL && isBot(players[i]) && isActive(players[i])) {
+      char key = bot_nextKey(players[i]);
+      if (key == '\0') {
+        continue;
+      }
+      if (options.tickRate > 0) {
+        player_queueKey(players[i], key);
+      } else {
+        applyKey(players[i], key);
+      }
+    }
+  }
+  return (options.tickRate > 0) ? false : publishTurn();
+}
+
+/**************** addBots ****************/
+/* 
+ * Fills the game with the bots asked for on the command line, before
+ * anyone joins; they take the first letters, and leave the rest of the
+ * places to people. The bots are a fixed count, added once: none are
+ * added or removed as people come and go.
+ */
+static void
+addBots(void)
+{
+  for (int i = 0; i < options.bots; i++) {
+    char name[] = "bot";
+    player_t* bot = player_new(message_noAddr(), name, 0, 0, ' ', matchArena);
+    if (bot == NULL || add_player(bot) != 0) {
+      player_delete(bot);
+      return;
+    }
+    placePlayer(bot);
+  }
+}
+
+/**************** loopTimeout ****************/
+/* 
+ * Returns how long the event loop may wait for a message before it
+ * must wake on its own: half a tick with --tick; half a bot step while
+ * the bots move; flushInterval while paced messages wait in the outbox
+ * or a capped spectator waits for a frame. Otherwise 0: the loop waits
+ * for the next message however long it takes.
+ */
+static float
+loopTimeout(void)
+{
+  float timeout = 0;
+  if (options.tickRate > 0) {
+    // waking twice per tick keeps an idle server's ticks close to on time
+    timeout = 0.5 / options.tickRate;
+  }
+  if (options.bots > 0 && humansPlaying() && (timeout == 0 || 0.5 / botRate < timeout)) {
+    timeout = 0.5 / botRate;
+  }
+  if ((outbox_pending() || spectators_behind()) && (timeout == 0 || flushInterval < timeout)) {
+    timeout = flushInterval;
+  }
+  return timeout;
+}
+
+/**************** humansPlaying ****************/
+/* 
+ * Returns true if any active player is a person rather than a bot.
+ */
+static bool
+humansPlaying(void)
+{
+  player_t** players = get_players();
+  for (int i = 0; i < maxPlayers; i++) {
+    if (players[i] != NULL && isActive(players[i]) && !isBot(players[i])) {
+      return true;
     }
   }
-  // normal case: keep looping
   return false;
 }
 
@@ -257,10 +748,7 @@ goldUpdate(addr_t address, player_t* player, int collected) {
   int p = get_gold(player);
   int r = get_available_gold();
   
-  char update[100];
-  sprintf(update, "GOLD %d %d %d", n, p, r);
-  
-  message_send(address, update);
+  outbox_send(address, scratch_printf("GOLD %d %d %d", n, p, r));
 }
 
 /**************** spectatorGoldUpdate ****************/
@@ -268,7 +756,7 @@ goldUpdate(addr_t address, player_t* player, int collected) {
  * Formats a goldUpdate correctly for a spectator using a helper function
  * 
  * Caller provides:
- *   game
+ *   the spectator's address, or message_noAddr() for every spectator
  * We return:
  *   char* update of gold
  */
@@ -278,8 +766,376 @@ spectatorGoldUpdate(addr_t address) {
   int p = 0;
   int r = get_available_gold();
 
-  char update[100];
-  sprintf(update, "GOLD %d %d %d", n, p, r);
+  char* update = scratch_printf("GOLD %d %d %d", n, p, r);
   
-  message_send(address, update);
+  if (message_isAddr(address)) {
+    outbox_send(address, update);
+  } else {
+    sendToSpectators(update);
+  }
+}
+
+/**************** statsAllowed ****************/
+/* 
+ * Returns true if the address's host was allowed with --stats-allow;
+ * the port does not matter. Loopback is not special: an operator on
+ * this machine names it, as with '--stats-allow 127.0.0.1'.
+ */
+static bool
+statsAllowed(const addr_t from)
+{
+  for (int i = 0; i < options.nStatsAllowed; i++) {
+    if (options.statsAllowed[i].s_addr == from.sin_addr.s_addr) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**************** buildStats ****************/
+/* 
+ * Builds the reply to STATS, in scratch memory: a line of name=value
+ * pairs. Rates are over the stats module's trailing window, the same
+ * for every caller, and handling times over the whole game.
+ */
+static const char*
+buildStats(void)
+{
+  int players = 0, bots = 0;
+  player_t** all = get_players();
+  for (int i = 0; i < maxPlayers; i++) {
+    if (all[i] != NULL && isActive(all[i])) {
+      if (isBot(all[i])) {
+        bots++;
+      } else {
+        players++;
+      }
+    }
+  }
+
+  double messagesIn, bytesIn, messagesOut, bytesOut;
+  stats_rates(&messagesIn, &bytesIn, &messagesOut, &bytesOut);
+  static histogram_t handling;       // 4 KiB, so not on the stack
+  stats_handling(&handling);
+
+  return scratch_printf("STATS players=%d bots=%d spectators=%d"
+      " inPerSec=%.1f outPerSec=%.1f inBytesPerSec=%.0f outBytesPerSec=%.0f"
+      " handleMeanUs=%.1f handleP99Us=%.1f memoryBytes=%zu gold=%d",
+      players, bots, spectator_count(),
+      messagesIn, messagesOut, bytesIn, bytesOut,
+      histogram_mean(&handling) / 1e3, histogram_percentile(&handling, 99) / 1e3,
+      mem_held(), get_available_gold());
+}
+
+/**************** reportLatency ****************/
+/* 
+ * Prints the round-trip time each player last reported, and the worst
+ * they reported, for players whose client measures it.
+ */
+static void
+reportLatency(void)
+{
+  player_t** players = get_players();
+  for (int i = 0; i < maxPlayers; i++) {
+    if (players[i] != NULL) {
+      int64_t maxRtt = 0;
+      int64_t rtt = outbox_rtt(get_address(players[i]), &maxRtt);
+      if (rtt > 0) {
+        printf("player %c (%s): rtt %.2f ms, worst %.2f ms\n", get_letter(players[i]),
+               get_name(players[i]), timing_seconds(rtt) * 1e3, timing_seconds(maxRtt) * 1e3);
+      }
+    }
+  }
+}
+
+/**************** reportMemory ****************/
+/* 
+ * Prints the memory each player holds, and its share spent on fog,
+ * then the total over all players, what the match's arena holds, and
+ * the allocations made by each subsystem.
+ */
+static void
+reportMemory(void)
+{
+  player_t** players = get_players();
+  size_t total = 0;
+  int count = 0;
+  for (int i = 0; i < maxPlayers; i++) {
+    if (players[i] != NULL) {
+      size_t fog = 0;
+      size_t bytes = player_memory(players[i], &fog);
+      printf("player %c (%s): %zu bytes, %zu of them fog\n", get_letter(players[i]),
+             get_name(players[i]), bytes, fog);
+      total += bytes;
+      count++;
+    }
+  }
+  printf("%d players hold %zu bytes\n", count, total);
+  mem_arena_report(stdout, "match arena", matchArena);
+  mem_report_subsystems(stdout, "allocations by subsystem");
+}
+
+/**************** catchSignals ****************/
+/* 
+ * Makes 'kill -USR1' print the stats so far, at the end of the event
+ * being handled, or the next one. When tracing, 'kill -USR2' likewise
+ * writes the trace so far, and SIGINT or SIGTERM ends the server
+ * cleanly, so that the trace is written on the way out.
+ */
+static void
+catchSignals(void)
+{
+  struct sigaction action = { .sa_handler = noteSignal };
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, NULL);
+  if (options.tracePath != NULL) {
+    sigaction(SIGUSR2, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+  }
 }
+
+/**************** noteSignal ****************/
+/* 
+ * Signal handler: notes the request, to be answered once the event
+ * being handled, if any, is done.
+ */
+static void
+noteSignal(int signal)
+{
+  if (signal == SIGUSR1) {
+    statsAsked = 1;
+  } else if (signal == SIGUSR2) {
+    traceAsked = 1;
+  } else {
+    stopAsked = 1;
+  }
+  // an idle loop may be waiting without limit; this wakes it to answer
+  message_setTimeout(signalWake);
+}
+
+/**************** answerSignals ****************/
+/* 
+ * Prints the stats so far, or writes the trace so far, if a signal
+ * asked for them.
+ * Return true if a signal asked the server to stop.
+ */
+static bool
+answerSignals(void)
+{
+  if (statsAsked) {
+    statsAsked = 0;
+    stats_report(stdout);
+    fflush(stdout);
+  }
+  if (traceAsked) {
+    traceAsked = 0;
+    if (!trace_write()) {
+      fprintf(stderr, "cannot write the trace '%s'\n", options.tracePath);
+    }
+  }
+  return stopAsked;
+}
+
+/* ****************************************************************** */
+/* ************************* UNIT_TEST ****************************** */
+/* 
+ * This unit test checks that steady-state play makes no heap
+ * allocation. It plays a game in-process, with the server's own
+ * options. First, with nobody joined yet, the loop times out a few
+ * times with the bots due, and the bots (if any) must not move. Then
+ * three players (one with a viewport) and a spectator join,
+ * then random keystrokes and pings from the players are fed to
+ * handleMessage as if they had arrived, and every few messages the
+ * loop times out, with the bots (if any) and the tick (if any) due.
+ * Once, a STATS query arrives from a socket of its own, as from an
+ * operator's tool (answered only if its host was allowed with
+ * --stats-allow, as the test target does for 127.0.0.1), and SIGUSR1 asks for the stats report.
+ * Each message and timeout is handled between no-allocation markers
+ * (see mem.h), which report any allocation with its subsystem; after a
+ * short warm-up those count as failures, up to the end of the game
+ * (whose summary is not steady state).
+ *
+ * The clients are sockets the test binds and never reads; the kernel
+ * discards what it sends them once their buffers fill.
+ *
+ * Run it with the server's arguments:
+ *   ./servertest --bots 2 --stats-allow 127.0.0.1 ../maps/main.txt 7
+ * Exit status is 0 if the bots held still and nothing was allocated
+ * after warm-up, 1 otherwise.
+ */
+
+#ifdef UNIT_TEST
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+static const int nClients = 4;         // three players, then a spectator
+static const int warmup = 20;          // messages before counting starts
+static const int maxMessages = 20000;
+static const int timeoutEvery = 4;     // messages between timeouts
+static const int idleTimeouts = 10;    // timeouts before anyone joins
+
+static bool bindClient(addr_t* address);
+static bool botsHoldStill(void);
+
+int
+main(int argc, char* argv[])
+{
+  if (!parseArgs(argc, argv)) {
+    fprintf(stderr, "usage: %s [--rate bytesPerSecond] [--tick hz] [--bots n] [--log file] [--log-level level] [--stats-allow host] [--trace file] map.txt [randomSeed]\n", argv[0]);
+    return 2;
+  }
+  botPeriod = 1e9 / botRate;
+  tickPeriod = (options.tickRate > 0) ? 1e9 / options.tickRate : 0;
+
+  matchArena = mem_assert(mem_arena_new(0), "match arena");
+  grid_t* grid = gridInit(options.mapPath, options.randomSeed, matchArena);
+  if (grid == NULL) {
+    fprintf(stderr, "can't load %s\n", options.mapPath);
+    return 2;
+  }
+  initialize_game(grid, matchArena);
+  outbox_init(options.rate);
+  addBots();
+  if (message_init(NULL) == 0) {
+    return 2;
+  }
+
+  // joining: the players, one of them with a small window on the map,
+  // and a spectator
+  addr_t clients[nClients];
+  addr_t tool;
+  for (int i = 0; i < nClients; i++) {
+    if (!bindClient(&clients[i])) {
+      fprintf(stderr, "can't make a client socket\n");
+      return 2;
+    }
+  }
+  if (!bindClient(&tool)) {
+    fprintf(stderr, "can't make a client socket\n");
+    return 2;
+  }
+  if (!botsHoldStill()) {
+    fprintf(stderr, "%s: bots moved before anyone joined\n", options.mapPath);
+    return 1;
+  }
+  handleMessage(NULL, clients[0], "PLAY alice");
+  handleMessage(NULL, clients[1], "PLAY bob");
+  handleMessage(NULL, clients[2], "PLAY carol");
+  handleMessage(NULL, clients[2], "VIEWPORT 8 20");
+  handleMessage(NULL, clients[3], "SPECTATE");
+
+  // playing: a keystroke or a ping from a random player, and now and
+  // then a timeout, when the bots and the tick are overdue
+  static const char keys[] = "hjklyubnHJKLYUBN";
+  srand(options.randomSeed);
+  int counted = 0;
+  int allocations = 0;
+  bool gameOver = false;
+  catchSignals();
+  for (int m = 0; m < maxMessages && !gameOver; m++) {
+    char message[32];
+    addr_t from = clients[rand() % (nClients - 1)];
+    if (rand() % 8 == 0) {
+      sprintf(message, "PING %d %d", m, 1000 + m);
+    } else {
+      sprintf(message, "KEY %c", keys[rand() % (sizeof(keys) - 1)]);
+    }
+    if (m == warmup) {
+      raise(SIGUSR1);     // the stats report, too, must not allocate
+    } else if (m == warmup + 1) {
+      strcpy(message, "STATS");
+      from = tool;
+    }
+
+    const bool steady = (m >= warmup);
+    if (steady) {
+      mem_noalloc_begin(message);
+    }
+    gameOver = handleMessage(NULL, from, message);
+    if (!gameOver && m % timeoutEvery == 0) {
+      nextBotStep = 0;
+      nextTick = 0;
+      gameOver = handleTimeout(NULL);
+    }
+    if (steady) {
+      int made = mem_noalloc_end();
+      if (!gameOver) {
+        allocations += made;
+        counted++;
+      }
+    }
+  }
+
+  fprintf(stderr, "%s: %d messages after warm-up, %d allocations%s\n", options.mapPath,
+          counted, allocations, gameOver ? "" : " (game not over)");
+
+  reportLatency();
+  reportMemory();
+  stats_report(stdout);
+  outbox_done();
+  message_done();
+  delete_game();
+  gridDelete();
+  mem_arena_delete(matchArena);
+  scratch_done();
+  return (allocations == 0 && counted > 0) ? 0 : 1;
+}
+
+/**************** botsHoldStill ****************/
+/* Time out a few times, with the bots and the tick due, before anyone
+ * has joined, and return true if every bot is where it started.
+ */
+static bool
+botsHoldStill(void)
+{
+  player_t** players = get_players();
+  int rows[maxPlayers], columns[maxPlayers];
+  for (int i = 0; i < maxPlayers; i++) {
+    if (players[i] != NULL) {
+      rows[i] = get_y(players[i]);
+      columns[i] = get_x(players[i]);
+    }
+  }
+  for (int t = 0; t < idleTimeouts; t++) {
+    nextBotStep = 0;
+    nextTick = 0;
+    if (handleTimeout(NULL)) {
+      return false;
+    }
+  }
+  for (int i = 0; i < maxPlayers; i++) {
+    if (players[i] != NULL && (get_y(players[i]) != rows[i] || get_x(players[i]) != columns[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**************** bindClient ****************/
+/* Bind a UDP socket on the loopback interface, on a port of the
+ * kernel's choosing, and make an address for it. The socket is left
+ * open, and unread, until exit.
+ */
+static bool
+bindClient(addr_t* address)
+{
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  local.sin_port = 0;
+  socklen_t length = sizeof(local);
+  if (sock < 0 || bind(sock, (struct sockaddr*)&local, sizeof(local)) != 0
+      || getsockname(sock, (struct sockaddr*)&local, &length) != 0) {
+    return false;
+  }
+  char port[16];
+  sprintf(port, "%d", ntohs(local.sin_port));
+  return message_setAddr("localhost", port, address);
+}
+
+#endif // UNIT_TEST
+
@@ -0,0 +1,268 @@
+/*
+ * stats.c - Nuggets 'stats' module
+ *
+ * see stats.h for more information.
+ *
+ * Binary Brigade, Spring 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include "stats.h"
+#include "../lib/histogram.h"
+#include "../lib/timing.h"
+
+/**************** local types ****************/
+typedef struct kind {
+  const char* name;
+  int64_t count;
+  int64_t bytes;
+  histogram_t times;
+} kind_t;
+
+typedef struct second {
+  int64_t second;     // seconds on the clock (see timing.h) this bucket counts
+  int64_t messagesIn, bytesIn, messagesOut, bytesOut;
+} second_t;
+
+/**************** global variables ****************/
+// the names of inbound kinds are matched against the message's first
+// word, except those of KEY, which classifyKey picks; the last is the
+// catch-all
+enum { inPlay, inSpectate, inKeyMove, inKeyRun, inKeyQuit, inKeyOther,
+       inPing, inViewport, inStats, inOther, nInbound };
+static kind_t inbound[nInbound] = {
+  [inPlay] = { "PLAY" }, [inSpectate] = { "SPECTATE" },
+  [inKeyMove] = { "KEY move" }, [inKeyRun] = { "KEY run" },
+  [inKeyQuit] = { "KEY quit" }, [inKeyOther] = { "KEY other" },
+  [inPing] = { "PING" }, [inViewport] = { "VIEWPORT" }, [inStats] = { "STATS" },
+  [inOther] = { "other" },
+};
+
+static kind_t outbound[] = {
+  { "OK" }, { "GRID" }, { "GOLD" }, { "DISPLAY" }, { "QUIT" }, { "PONG" },
+  { "ERROR" }, { "STATS" }, { "other" },
+};
+static const int nOutbound = sizeof(outbound) / sizeof(outbound[0]);
+
+static kind_t phases[stats_nPhases] = {
+  [stats_visibility] = { "visibility" },
+  [stats_render] = { "render" },
+};
+
+// the traffic in each of the last stats_window seconds, a ring indexed
+// by the second; a bucket is cleared when its second comes round again
+static second_t window[stats_window];
+static int64_t firstSecond = -1;    // of the first message counted
+
+/**************** local functions ****************/
+static kind_t* classify(kind_t* kinds, const int nKinds, const char* message);
+static kind_t* classifyKey(const char* key);
+static void count(kind_t* kind, const size_t length, const int64_t elapsed);
+static second_t* thisSecond(const int64_t now);
+static void reportKinds(FILE* fp, const char* title, const kind_t* kinds, const int nKinds);
+
+/**************** stats_received ****************/
+/* see stats.h for description */
+void
+stats_received(const char* message, const size_t length, const int64_t elapsed)
+{
+  kind_t* kind;
+  if (strncmp(message, "KEY ", strlen("KEY ")) == 0) {
+    kind = classifyKey(message + strlen("KEY "));
+  } else {
+    kind = classify(inbound, nInbound, message);
+  }
+  count(kind, length, elapsed);
+
+  second_t* bucket = thisSecond(timing_now());
+  bucket->messagesIn++;
+  bucket->bytesIn += length;
+}
+
+/**************** stats_sent ****************/
+/* see stats.h for description */
+void
+stats_sent(const char* message, const size_t length, const int64_t elapsed)
+{
+  count(classify(outbound, nOutbound, message), length, elapsed);
+
+  second_t* bucket = thisSecond(timing_now());
+  bucket->messagesOut++;
+  bucket->bytesOut += length;
+}
+
+/**************** stats_phase ****************/
+/* see stats.h for description */
+void
+stats_phase(const stats_phase_t phase, const int64_t elapsed)
+{
+  histogram_record(&phases[phase].times, elapsed);
+  phases[phase].count++;
+}
+
+/**************** stats_totals ****************/
+/* see stats.h for description */
+void
+stats_totals(int64_t* messagesIn, int64_t* bytesIn,
+             int64_t* messagesOut, int64_t* bytesOut)
+{
+  int64_t inCount = 0, inBytes = 0, outCount = 0, outBytes = 0;
+  for (int i = 0; i < nInbound; i++) {
+    inCount += inbound[i].count;
+    inBytes += inbound[i].bytes;
+  }
+  for (int i = 0; i < nOutbound; i++) {
+    outCount += outbound[i].count;
+    outBytes += outbound[i].bytes;
+  }
+  if (messagesIn != NULL) *messagesIn = inCount;
+  if (bytesIn != NULL) *bytesIn = inBytes;
+  if (messagesOut != NULL) *messagesOut = outCount;
+  if (bytesOut != NULL) *bytesOut = outBytes;
+}
+
+/**************** stats_rates ****************/
+/* see stats.h for description */
+void
+stats_rates(double* messagesIn, double* bytesIn,
+            double* messagesOut, double* bytesOut)
+{
+  int64_t now = timing_now();
+  int64_t second = now / 1000000000;
+  int64_t inCount = 0, inBytes = 0, outCount = 0, outBytes = 0;
+  for (int i = 0; i < stats_window; i++) {
+    if (window[i].second > second - stats_window) {
+      inCount += window[i].messagesIn;
+      inBytes += window[i].bytesIn;
+      outCount += window[i].messagesOut;
+      outBytes += window[i].bytesOut;
+    }
+  }
+
+  // the window ends now, part way through this second, and does not
+  // reach back before the first message
+  double seconds = stats_window - 1 + timing_seconds(now % 1000000000);
+  double sinceFirst = timing_seconds(now - firstSecond * 1000000000);
+  if (firstSecond >= 0 && sinceFirst < seconds) {
+    seconds = sinceFirst;
+  }
+  if (seconds <= 0) {
+    seconds = 1;
+  }
+  if (messagesIn != NULL) *messagesIn = inCount / seconds;
+  if (bytesIn != NULL) *bytesIn = inBytes / seconds;
+  if (messagesOut != NULL) *messagesOut = outCount / seconds;
+  if (bytesOut != NULL) *bytesOut = outBytes / seconds;
+}
+
+/**************** stats_handling ****************/
+/* see stats.h for description */
+void
+stats_handling(histogram_t* times)
+{
+  histogram_reset(times);
+  for (int i = 0; i < nInbound; i++) {
+    histogram_merge(times, &inbound[i].times);
+  }
+}
+
+/**************** stats_report ****************/
+/* see stats.h for description */
+void
+stats_report(FILE* fp)
+{
+  fprintf(fp, "%-12s %9s %11s %9s %9s %9s %9s %9s\n", "", "count", "bytes",
+          "mean us", "p50", "p99", "p99.9", "max");
+  reportKinds(fp, "received (time to handle)", inbound, nInbound);
+  reportKinds(fp, "sent (time to send)", outbound, nOutbound);
+  reportKinds(fp, "phases", phases, stats_nPhases);
+}
+
+/**************** thisSecond ****************/
+/* Return the window's bucket for the second containing 'now', clearing
+ * it first if it last counted an earlier second.
+ */
+static second_t*
+thisSecond(const int64_t now)
+{
+  int64_t second = now / 1000000000;
+  second_t* bucket = &window[second % stats_window];
+  if (bucket->second != second) {
+    *bucket = (second_t){ .second = second };
+  }
+  if (firstSecond < 0) {
+    firstSecond = second;
+  }
+  return bucket;
+}
+
+/**************** classify ****************/
+/* Return the kind whose name is the message's first word, or the last
+ * kind (the catch-all) if none is.
+ */
+static kind_t*
+classify(kind_t* kinds, const int nKinds, const char* message)
+{
+  for (int i = 0; i < nKinds - 1; i++) {
+    size_t length = strlen(kinds[i].name);
+    if (strncmp(message, kinds[i].name, length) == 0
+        && (message[length] == ' ' || message[length] == '\0')) {
+      return &kinds[i];
+    }
+  }
+  return &kinds[nKinds - 1];
+}
+
+/**************** classifyKey ****************/
+/* Return the inbound kind for a KEY message with the given key.
+ */
+static kind_t*
+classifyKey(const char* key)
+{
+  if (key[0] == '\0' || key[1] != '\0') {
+    return &inbound[inKeyOther];
+  } else if (key[0] == 'Q') {
+    return &inbound[inKeyQuit];
+  } else if (strchr("hjklyubn", tolower(key[0])) != NULL) {
+    return islower(key[0]) ? &inbound[inKeyMove] : &inbound[inKeyRun];
+  } else {
+    return &inbound[inKeyOther];
+  }
+}
+
+/**************** count ****************/
+/* Count one message of the kind.
+ */
+static void
+count(kind_t* kind, const size_t length, const int64_t elapsed)
+{
+  kind->count++;
+  kind->bytes += length;
+  histogram_record(&kind->times, elapsed);
+}
+
+/**************** reportKinds ****************/
+/* Print one line for each kind that has been seen, under a title.
+ */
+static void
+reportKinds(FILE* fp, const char* title, const kind_t* kinds, const int nKinds)
+{
+  fprintf(fp, "%s:\n", title);
+  for (int i = 0; i < nKinds; i++) {
+    const kind_t* kind = &kinds[i];
+    if (kind->count > 0) {
+      fprintf(fp, "%-12s %9lld %11lld %9.1f %9.1f %9.1f %9.1f %9.1f\n", kind->name,
+              (long long)kind->count, (long long)kind->bytes,
+              histogram_mean(&kind->times) / 1e3,
+              histogram_percentile(&kind->times, 50) / 1e3,
+              histogram_percentile(&kind->times, 99) / 1e3,
+              histogram_percentile(&kind->times, 99.9) / 1e3,
+              kind->times.max / 1e3);
+    }
+  }
+}
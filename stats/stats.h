@@ -0,0 +1,82 @@
+/*
+ * stats.h - header file for Nuggets stats module
+ *
+ * The server keeps, for every kind of message it receives or sends, a
+ * count, a byte total, and a latency histogram (see lib/histogram.h):
+ * for inbound messages, the time to handle them, from arrival to the
+ * last reply being queued or sent; for outbound messages, the time
+ * message_send took. Two phases of building a display, the visibility
+ * update and the rendering, get histograms of their own, so that a lag
+ * spike can be pinned on visibility, rendering, or the network.
+ *
+ * Inbound messages are told apart by their first word, and KEY by
+ * action: a one-step move (lower case), a run (upper case), Q, or any
+ * other key. Outbound messages are told apart by their first word.
+ *
+ * Everything is kept in fixed-size, static tables: recording never
+ * allocates.
+ *
+ * Binary Brigade, Spring 2023
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "../lib/histogram.h"
+
+/**************** global types ****************/
+typedef enum { stats_visibility, stats_render, stats_nPhases } stats_phase_t;
+
+/**************** global constants ****************/
+enum { stats_window = 10 };   // seconds over which stats_rates averages
+
+/**************** stats_received ****************/
+/* Count an inbound message, of the given length, that took 'elapsed'
+ * nanoseconds to handle.
+ */
+void stats_received(const char* message, const size_t length, const int64_t elapsed);
+
+/**************** stats_sent ****************/
+/* Count an outbound message, of the given length, that took 'elapsed'
+ * nanoseconds to send.
+ */
+void stats_sent(const char* message, const size_t length, const int64_t elapsed);
+
+/**************** stats_phase ****************/
+/* Record that one run of the phase took 'elapsed' nanoseconds.
+ */
+void stats_phase(const stats_phase_t phase, const int64_t elapsed);
+
+/**************** stats_totals ****************/
+/* Store the messages and bytes received and sent so far, over all
+ * kinds, in whichever of the pointers are not NULL.
+ */
+void stats_totals(int64_t* messagesIn, int64_t* bytesIn,
+                  int64_t* messagesOut, int64_t* bytesOut);
+
+/**************** stats_rates ****************/
+/* Store the messages and bytes received and sent per second, over all
+ * kinds, in whichever of the pointers are not NULL. The rates are over
+ * the trailing stats_window seconds (or since the first message, if
+ * that was more recent), so every caller sees the same figures.
+ */
+void stats_rates(double* messagesIn, double* bytesIn,
+                 double* messagesOut, double* bytesOut);
+
+/**************** stats_handling ****************/
+/* Store in 'times' the handling times of every inbound message so far,
+ * over all kinds.
+ */
+void stats_handling(histogram_t* times);
+
+/**************** stats_report ****************/
+/* Print a table of every kind of message seen, and every phase run:
+ * count, bytes, and mean, median, 99th and 99.9th percentile, and
+ * largest time, in microseconds.
+ */
+void stats_report(FILE* fp);
+
+#endif // _STATS_H_
@@ -0,0 +1,190 @@
+/* 
+ * binlog - asynchronous binary log of the messages sent and received
+ *
+ * See binlog.h for the interface, and the file format.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "binlog.h"
+
+/**************** local constants ****************/
+static const size_t ringSize = 4096;          // records; a power of two
+static const long idleNanoseconds = 1000000;  // drainer's nap when the ring is empty
+
+/**************** local types ****************/
+typedef struct record {
+  int64_t time;
+  uint32_t ip;
+  uint16_t port;
+  uint8_t kind;
+  uint32_t length;                     // of the whole message
+  uint16_t stored;                     // bytes of it in payload
+  char payload[binlog_MaxPayload];
+} record_t;
+
+/**************** global variables ****************/
+// the ring holds records tail..head-1 (mod ringSize); only the producer
+// moves head, and only the drainer moves tail
+static struct {
+  record_t* ring;
+  _Atomic size_t head;
+  _Atomic size_t tail;
+  _Atomic bool stopping;
+  atomic_long dropped;
+  FILE* fp;
+  pthread_t drainer;
+  bool started;
+} binlog;
+
+/**************** local functions ****************/
+static void* drain(void* unused);
+static bool drainRecords(void);
+static void writeRecord(const record_t* record);
+
+/**************** binlog_init ****************/
+/* see binlog.h for description */
+bool
+binlog_init(const char* path)
+{
+  if (binlog.started || path == NULL) {
+    return false;
+  }
+  binlog.fp = fopen(path, "w");
+  if (binlog.fp == NULL) {
+    return false;
+  }
+  binlog.ring = calloc(ringSize, sizeof(record_t));
+  if (binlog.ring == NULL) {
+    fclose(binlog.fp);
+    return false;
+  }
+  fwrite(binlog_Magic, sizeof(binlog_Magic), 1, binlog.fp);
+  atomic_store(&binlog.head, 0);
+  atomic_store(&binlog.tail, 0);
+  atomic_store(&binlog.stopping, false);
+  atomic_store(&binlog.dropped, 0);
+  if (pthread_create(&binlog.drainer, NULL, drain, NULL) != 0) {
+    free(binlog.ring);
+    fclose(binlog.fp);
+    return false;
+  }
+  binlog.started = true;
+  return true;
+}
+
+/**************** binlog_record ****************/
+/* see binlog.h for description */
+void
+binlog_record(const binlog_kind_t kind, const addr_t address,
+              const char* message, const size_t length)
+{
+  if (!binlog.started) {
+    return;
+  }
+  size_t head = atomic_load_explicit(&binlog.head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&binlog.tail, memory_order_acquire);
+  if (head - tail == ringSize) {
+    atomic_fetch_add_explicit(&binlog.dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  record_t* record = &binlog.ring[head & (ringSize - 1)];
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  record->time = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  record->ip = address.sin_addr.s_addr;
+  record->port = address.sin_port;
+  record->kind = kind;
+  record->length = length;
+  record->stored = length < binlog_MaxPayload ? length : binlog_MaxPayload;
+  memcpy(record->payload, message, record->stored);
+
+  // publishing the record only once it is complete
+  atomic_store_explicit(&binlog.head, head + 1, memory_order_release);
+}
+
+/**************** binlog_dropped ****************/
+/* see binlog.h for description */
+long
+binlog_dropped(void)
+{
+  return atomic_load(&binlog.dropped);
+}
+
+/**************** binlog_done ****************/
+/* see binlog.h for description */
+void
+binlog_done(void)
+{
+  if (!binlog.started) {
+    return;
+  }
+  atomic_store(&binlog.stopping, true);
+  pthread_join(binlog.drainer, NULL);
+  drainRecords();
+  fclose(binlog.fp);
+  free(binlog.ring);
+  binlog.ring = NULL;
+  binlog.started = false;
+}
+
+/**************** drain ****************/
+/* The drainer thread: write records as they appear, flushing the file
+ * whenever the ring runs empty, until asked to stop.
+ */
+static void*
+drain(void* unused)
+{
+  struct timespec nap = { 0, idleNanoseconds };
+  while (!atomic_load(&binlog.stopping)) {
+    if (!drainRecords()) {
+      fflush(binlog.fp);
+      nanosleep(&nap, NULL);
+    }
+  }
+  return NULL;
+}
+
+/**************** drainRecords ****************/
+/* Write every record now in the ring, and free their slots.
+ * Return true if there were any.
+ */
+static bool
+drainRecords(void)
+{
+  size_t tail = atomic_load_explicit(&binlog.tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&binlog.head, memory_order_acquire);
+  if (tail == head) {
+    return false;
+  }
+  for (; tail != head; tail++) {
+    writeRecord(&binlog.ring[tail & (ringSize - 1)]);
+  }
+  atomic_store_explicit(&binlog.tail, tail, memory_order_release);
+  return true;
+}
+
+/**************** writeRecord ****************/
+/* Write one record in the compact form described in binlog.h.
+ */
+static void
+writeRecord(const record_t* record)
+{
+  fwrite(&record->time, sizeof(record->time), 1, binlog.fp);
+  fwrite(&record->ip, sizeof(record->ip), 1, binlog.fp);
+  fwrite(&record->port, sizeof(record->port), 1, binlog.fp);
+  fwrite(&record->kind, sizeof(record->kind), 1, binlog.fp);
+  fwrite(&record->length, sizeof(record->length), 1, binlog.fp);
+  fwrite(&record->stored, sizeof(record->stored), 1, binlog.fp);
+  fwrite(record->payload, 1, record->stored, binlog.fp);
+}
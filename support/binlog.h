@@ -0,0 +1,66 @@
+/* 
+ * binlog - asynchronous binary log of the messages sent and received
+ *
+ * The text log (see log.h) formats every message with fprintf, and
+ * flushes, on the thread that sends it. The binary log costs that
+ * thread only a copy: each message becomes a fixed-size record in a
+ * ring buffer, and a background thread drains the ring into a compact
+ * binary file, which the 'logdecode' program turns back into text.
+ *
+ * Records are written by one thread (the one calling message_send and
+ * message_loop) and read by the drainer; no locks are taken. If the
+ * drainer falls behind and the ring fills, new records are dropped and
+ * counted rather than waited for. A record keeps the first
+ * binlog_MaxPayload bytes of its message, and the message's full length.
+ *
+ * File format, in host byte order: the 8 bytes of binlog_Magic, then
+ * for each record
+ *   int64 time (ns since the epoch), uint32 IPv4 address, uint16 port
+ *   (both in network byte order), uint8 kind, uint32 message length,
+ *   uint16 n, and the first n bytes of the message.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#ifndef _BINLOG_H_
+#define _BINLOG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "message.h"
+
+/****************** constants *********************/
+static const char binlog_Magic[8] = { 'N', 'U', 'G', 'B', 'L', 'O', 'G', '1' };
+enum { binlog_MaxPayload = 228 };            // bytes of each message kept
+
+// what happened to the message in a record
+typedef enum { binlog_sent, binlog_received, binlog_sendFailed } binlog_kind_t;
+
+/**************** binlog_init ****************/
+/* Open (truncating) the binary log at 'path', and start the drainer.
+ * We return:
+ *   true on success; false if the file cannot be opened or the thread
+ *   cannot be started, in which case nothing is logged.
+ * Caller is responsible for calling binlog_done later.
+ */
+bool binlog_init(const char* path);
+
+/**************** binlog_record ****************/
+/* Log one message, of the given length, sent to or received from the
+ * address. Does nothing unless binlog_init succeeded. Never blocks.
+ */
+void binlog_record(const binlog_kind_t kind, const addr_t address,
+                   const char* message, const size_t length);
+
+/**************** binlog_dropped ****************/
+/* Return the number of records dropped because the ring was full.
+ */
+long binlog_dropped(void);
+
+/**************** binlog_done ****************/
+/* Stop the drainer, after it has written every record logged so far,
+ * and close the file.
+ */
+void binlog_done(void);
+
+#endif // _BINLOG_H_
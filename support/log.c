@@ -6,10 +6,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <sys/errno.h>
 #include "log.h"
 
+/**************** global variables ****************/
+log_level_t flog_level = log_info;   // see log_setLevel
+static const char* levelNames[] = { "error", "warn", "info", "debug", "trace" };
+
 /**************** flog_init ****************/
 /* Initialize the logging module.
  */
@@ -101,3 +106,46 @@ flog_done(FILE* fp)
 {
   flog_v(fp, "END OF LOG");
 }
+
+/**************** flog_at ****************/
+/* 
+ * log a formatted line, prefixed by its level, if logging is enabled.
+ * Only errors and warnings are flushed at once.
+ */
+void
+flog_at(FILE* fp, const log_level_t level, const char* format, ...)
+{
+  if (fp != NULL && format != NULL) {
+    fprintf(fp, "%s: ", levelNames[level]);
+    va_list args;
+    va_start(args, format);
+    vfprintf(fp, format, args);
+    va_end(args);
+    fputc('\n', fp);
+    if (level <= log_warn) {
+      fflush(fp);
+    }
+  }
+}
+
+/**************** log_setLevel ****************/
+/* see log.h for description */
+void
+log_setLevel(const log_level_t level)
+{
+  flog_level = level;
+}
+
+/**************** log_parseLevel ****************/
+/* see log.h for description */
+bool
+log_parseLevel(const char* name, log_level_t* level)
+{
+  for (int i = log_error; i <= log_trace; i++) {
+    if (strcmp(name, levelNames[i]) == 0) {
+      *level = i;
+      return true;
+    }
+  }
+  return false;
+}
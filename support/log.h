@@ -10,6 +10,13 @@
  * the log_x functions will be ignored and nothing will be logged.
  * 
  * The flog_x functions should not be called by the module user.
+ *
+ * Messages may also be logged at a level, with log_at; see the note on
+ * levels below. Leveled messages are filtered twice: those above
+ * LOG_LEVEL are compiled out entirely, and those above the level set
+ * with log_setLevel are skipped at run time, before their arguments
+ * are evaluated. Leveled messages are flushed only at log_warn and
+ * below, so tracing a hot path does not cost a flush per message.
  * 
  * See the note below about file-local global variables; if log.h is included
  * by multiple source files within a single program, *each* such file has
@@ -24,6 +31,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 /*********** file-local global variable ****************/
 /* Here is an example of a judicious use of a global variable.
@@ -90,4 +98,47 @@ static inline void log_done(void) { flog_done(logFP); logFP = NULL; }
  * It is the caller's responsibility to close the file, if desired.
  */
 
+/*********** levels ****************/
+/* From most to least important. A program's hot paths (e.g., every
+ * message the server handles) belong at log_trace.
+ */
+typedef enum { log_error, log_warn, log_info, log_debug, log_trace } log_level_t;
+
+/* LOG_LEVEL: the least important level compiled in. Release builds
+ * (compiled with -DNDEBUG) keep log_info and above; others keep all.
+ * Either can be overridden with -DLOG_LEVEL=log_xxx.
+ */
+#ifndef LOG_LEVEL
+#ifdef NDEBUG
+#define LOG_LEVEL log_info
+#else
+#define LOG_LEVEL log_trace
+#endif
+#endif
+
+extern log_level_t flog_level;
+void flog_at(FILE* fp, const log_level_t level, const char* format, ...);
+#define log_at(level, ...)                                           \
+  do {                                                               \
+    if ((level) <= LOG_LEVEL && (level) <= flog_level && logFP != NULL) { \
+      flog_at(logFP, (level), __VA_ARGS__);                          \
+    }                                                                \
+  } while (0)
+/* log_at: printf a line to the log, with its level, if that level is
+ * both compiled in and currently enabled. Takes a format string and any
+ * number of arguments; a newline is added. Example:
+ *   log_at(log_trace, "message from %s: '%s'", message_stringAddr(from), message);
+ * The arguments are not evaluated unless the line is logged.
+ */
+
+void log_setLevel(const log_level_t level);
+/* log_setLevel: log only messages at 'level' or more important, in
+ * every file of the program; the default is log_info.
+ */
+
+bool log_parseLevel(const char* name, log_level_t* level);
+/* log_parseLevel: translate "error", "warn", "info", "debug", or
+ * "trace" into *level; return false if 'name' is none of those.
+ */
+
 #endif // _LOG_H_
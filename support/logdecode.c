@@ -0,0 +1,121 @@
+/* 
+ * logdecode - print a binary message log (see binlog.h) as text
+ *
+ * usage: ./logdecode logfile
+ *
+ * Prints one line per record: the time (seconds since the epoch), the
+ * kind (TO, FROM, or FAILED), the address, the message length, and the
+ * logged part of the message, with newlines and other non-printing
+ * characters escaped; "..." marks a message longer than what was kept.
+ *
+ * Exits 0 on success, 1 on bad arguments, 2 if the file cannot be read
+ * or is not a binary message log, 3 if the file ends mid-record.
+ *
+ * Binary Brigade, Spring, 2023
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+#include "binlog.h"
+
+/**************** local functions ****************/
+static bool readRecord(FILE* fp, bool* ok);
+static void printEscaped(const char* text, const size_t length);
+
+/**************** main ****************/
+int
+main(const int argc, char* argv[])
+{
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s logfile\n", argv[0]);
+    exit(1);
+  }
+  FILE* fp = fopen(argv[1], "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "%s: cannot open '%s'\n", argv[0], argv[1]);
+    exit(2);
+  }
+  char magic[sizeof(binlog_Magic)];
+  if (fread(magic, sizeof(magic), 1, fp) != 1
+      || memcmp(magic, binlog_Magic, sizeof(magic)) != 0) {
+    fprintf(stderr, "%s: '%s' is not a binary message log\n", argv[0], argv[1]);
+    fclose(fp);
+    exit(2);
+  }
+
+  bool ok = true;
+  while (readRecord(fp, &ok)) {
+  }
+  fclose(fp);
+  if (!ok) {
+    fprintf(stderr, "%s: '%s' ends in the middle of a record\n", argv[0], argv[1]);
+    exit(3);
+  }
+  exit(0);
+}
+
+/**************** readRecord ****************/
+/* Read one record and print it.
+ * Return false at the end of the file; set *ok false if the end comes
+ * in the middle of a record.
+ */
+static bool
+readRecord(FILE* fp, bool* ok)
+{
+  int64_t time;
+  uint32_t ip;
+  uint16_t port;
+  uint8_t kind;
+  uint32_t length;
+  uint16_t stored;
+  char payload[binlog_MaxPayload];
+
+  if (fread(&time, sizeof(time), 1, fp) != 1) {
+    return false;
+  }
+  if (fread(&ip, sizeof(ip), 1, fp) != 1
+      || fread(&port, sizeof(port), 1, fp) != 1
+      || fread(&kind, sizeof(kind), 1, fp) != 1
+      || fread(&length, sizeof(length), 1, fp) != 1
+      || fread(&stored, sizeof(stored), 1, fp) != 1
+      || stored > binlog_MaxPayload
+      || fread(payload, 1, stored, fp) != stored) {
+    *ok = false;
+    return false;
+  }
+
+  struct in_addr address = { .s_addr = ip };
+  const char* kindName = kind == binlog_sent ? "TO"
+                         : kind == binlog_received ? "FROM" : "FAILED";
+  printf("%lld.%09lld %-6s %s:%u %u ", (long long)(time / 1000000000),
+         (long long)(time % 1000000000), kindName, inet_ntoa(address),
+         ntohs(port), length);
+  printEscaped(payload, stored);
+  printf("%s\n", stored < length ? "..." : "");
+  return true;
+}
+
+/**************** printEscaped ****************/
+/* Print the text with backslash escapes for anything not printable.
+ */
+static void
+printEscaped(const char* text, const size_t length)
+{
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = text[i];
+    if (c == '\n') {
+      printf("\\n");
+    } else if (c == '\\') {
+      printf("\\\\");
+    } else if (isprint(c)) {
+      putchar(c);
+    } else {
+      printf("\\x%02x", c);
+    }
+  }
+}
@@ -6,7 +6,8 @@
  * and may be reordered, but require no connection setup or teardown.
  * 
  * See message.h for detailed interface description for each function.
- * Depends on the 'log' module and thus must be linked with log.o.
+ * Depends on the 'log' and 'binlog' modules and thus must be linked with
+ * log.o and binlog.o (and -pthread).
  * 
  * Compile with -DUNIT_TEST for a standalone unit test; see below.
  *
@@ -23,9 +24,11 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <signal.h>
 #include <math.h>
 #include "message.h"
 #include "log.h"
+#include "binlog.h"
 
 /**************** file-local constants ****************/
 /* See message.h for other constants (shared with users of this module).
@@ -48,6 +51,11 @@ static const int MaxPort = 65535;
  */
 static int ourSocket = 0;     // socket on which to receive messages
 
+// microseconds message_loop waits before calling handleTimeout, 0 for
+// no limit; changed by message_setTimeout, even from a signal handler
+static volatile sig_atomic_t loopTimeout = 0;
+static const float maxTimeout = 2000;   // seconds; fits loopTimeout
+
 /***********************************************************************/
 /**************** message_init ****************/
 /* 
@@ -145,6 +153,20 @@ message_eqAddr(const addr_t a, const addr_t b)
     && a.sin_addr.s_addr == b.sin_addr.s_addr;
 }
 
+/**************** message_hashAddr ****************/
+/* 
+ * Return a hash of the fields compared by message_eqAddr.
+ * See message.h for detailed description.
+ */
+unsigned int
+message_hashAddr(const addr_t addr)
+{
+  unsigned int hash = addr.sin_addr.s_addr;
+  hash = hash * 31 + addr.sin_port;
+  hash = hash * 31 + addr.sin_family;
+  return hash * 2654435761u;    // spread the bits (Knuth's multiplier)
+}
+
 /**************** message_setAddr ****************/
 /* 
  * Convert a textual address into a correspondent address.
@@ -253,13 +275,18 @@ message_send(const addr_t to, const char* message)
     log_v("message_send: called with null message");
     return; // error in usage of this function.
   }
-  if (sendto(ourSocket, message, strlen(message), 0,
+  size_t length = strlen(message);
+  if (sendto(ourSocket, message, length, 0,
              (struct sockaddr *) &to, sizeof(to)) < 0) {
     log_e("message_send: error sending to datagram socket");
+    binlog_record(binlog_sendFailed, to, message, length);
   } else {
-    log_s("message_send: TO %s", message_stringAddr(to));
-    log_d("message_send: %d lines:", numLines(message));
-    log_s("%s", message);
+    binlog_record(binlog_sent, to, message, length);
+    if (logFP != NULL) {
+      log_s("message_send: TO %s", message_stringAddr(to));
+      log_d("message_send: %d lines:", numLines(message));
+      log_s("%s", message);
+    }
   }
 }
 
@@ -292,19 +319,11 @@ message_loop(void* arg, const float timeout,
     log_v("message_loop called with null handleTimeout but timeout > 0");
     return false; // error in usage of this function.
   }
-  if (handleTimeout != NULL && timeout <= 0.0) {
-    log_v("message_loop called with Timeout handler but timeout <= 0");
-    return false; // error in usage of this function.
-  }
 
-  // set up for timeouts, if desired
+  // set up for timeouts, if desired; a handler may change the timeout
   struct timeval* timerp = NULL; // stays null if no timeout desired
   struct timeval  timer;          // timerp = &timer if timeout desired
-  struct timeval  timeoutval;     // timeval equivalent of parameter 'timeout'
-  if (timeout > 0.0) {
-    timeoutval.tv_sec  = (int)timeout;
-    timeoutval.tv_usec = timeout - (int)timeout;
-  }
+  message_setTimeout(timeout);
 
   // loop until error or some handler indicates time to quit looping
   while (true) {
@@ -322,8 +341,10 @@ message_loop(void* arg, const float timeout,
       FD_SET(ourSocket, &rfds); // monitor the socket
       nfds = ourSocket+1;       // highest-numbered fd in rfds
     }
-    if (timeout > 0.0) {      // is timeout desired?
-      timer = timeoutval;     // set the timer to the timeout value
+    const long micros = loopTimeout;
+    if (handleTimeout != NULL && micros > 0) {  // is timeout desired?
+      timer.tv_sec  = micros / 1000000;         // set the timer to the timeout value
+      timer.tv_usec = micros % 1000000;
       timerp = &timer;        // pass that timer to select
     } else {
       timerp = NULL;          // no timeout is desired
@@ -379,9 +400,12 @@ message_loop(void* arg, const float timeout,
             log_d("message_loop: non-Internet family %d\n", sender.sin_family);
           } else {
 	    // record it
-	    log_s("message_loop: FROM %s", message_stringAddr(sender));
-	    log_d("message_loop: %d lines:", numLines(buf));
-	    log_s("%s", buf);
+	    binlog_record(binlog_received, sender, buf, nbytes);
+	    if (logFP != NULL) {
+	      log_s("message_loop: FROM %s", message_stringAddr(sender));
+	      log_d("message_loop: %d lines:", numLines(buf));
+	      log_s("%s", buf);
+	    }
 
             // handle it
             if (handleMessage != NULL && (*handleMessage)(arg, sender, buf)) {
@@ -395,6 +419,23 @@ message_loop(void* arg, const float timeout,
   return true;
 }
 
+/**************** message_setTimeout ****************/
+/* 
+ * Change how long message_loop waits before calling handleTimeout.
+ * See message.h for detailed description.
+ */
+void
+message_setTimeout(const float timeout)
+{
+  if (timeout <= 0.0) {
+    loopTimeout = 0;
+  } else {
+    float seconds = timeout < maxTimeout ? timeout : maxTimeout;
+    long micros = seconds * 1000000;
+    loopTimeout = micros > 0 ? micros : 1;
+  }
+}
+
 /**************** message_done ****************/
 /* 
  * Clean up the message module, prior to exit.
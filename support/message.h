@@ -90,6 +90,15 @@ bool message_isAddr(const addr_t addr);
  */
 bool message_eqAddr(const addr_t a, const addr_t b);
 
+/******************************************/
+/* message_hashAddr: hash an address, e.g., for a hash table.
+ * Caller provides: an address
+ * Function returns: a number that is the same for any two addresses
+ *   that message_eqAddr considers equal.
+ * Logs: nothing.
+ */
+unsigned int message_hashAddr(const addr_t addr);
+
 /******************************************/
 /* message_setAddr: initialize an address to a given hostname and port.
  * Caller provides: 
@@ -154,6 +163,8 @@ void message_send(const addr_t to, const char* message);
  *   Handlers should return true to terminate looping, false to keep looping.
  * Notes:
  *   The timeout feature is optional; use timeout=0 and handleTimeout=NULL.
+ *   With a handleTimeout but timeout=0, the loop waits without limit
+ *   until message_setTimeout gives it a timeout.
  * Logs:
  *   errors in arguments,
  *   errors in monitoring stdin and/or network,
@@ -166,6 +177,18 @@ bool message_loop(void* arg, const float timeout,
                                         const addr_t from, 
                                         const char* message));
 
+/******************************************/
+/* message_setTimeout: change the timeout of message_loop.
+ * Caller provides:
+ *   a time duration (in seconds) after which to call "timeout",
+ *   or 0 to wait for input or a message however long it takes.
+ * Takes effect the next time the loop waits: from a handler, once the
+ * handler returns; from a signal handler (it is safe to call there),
+ * at once, since the signal interrupts the wait.
+ * Logs: nothing.
+ */
+void message_setTimeout(const float timeout);
+
 /******************************************/
 /* message_done: shut down the module.
  * Caller provides: nothing.